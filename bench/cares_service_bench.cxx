@@ -0,0 +1,452 @@
+/*
+ * cares_service_bench: resolves against an in-process DNS responder and
+ * reports resolves/sec, latency percentiles and allocations per resolve for
+ * a matrix of resolve modes, thread counts and single vs pooled channels.
+ *
+ *   cares_service_bench [--count=N] [--concurrency=N] [--unique=N]
+ *                       [--latency-ms=N] [--loss=P] [--truncate=P]
+ *                       [--threads=1,2,4] [--modes=ipv4_only,both]
+ *                       [--ares-arena]
+ *
+ * loss and truncate are probabilities in [0, 1]. Lost queries only come
+ * back as timeouts, truncated ones are retried over tcp. --ares-arena
+ * sends c-ares' own allocations through use_recycling_allocator().
+ */
+#include <new>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <boost/asio.hpp>
+#include <ares.h>
+
+#include <cares_service/cares.hxx>
+
+namespace {
+
+/* allocations of the resolving side, the responder thread doesn't count */
+std::atomic<uint64_t> allocations{0};
+thread_local bool count_allocations = true;
+
+void *CountingMalloc(size_t size) {
+    if (count_allocations) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return std::malloc(size);
+}
+
+void *CountingRealloc(void *ptr, size_t size) {
+    if (count_allocations) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+    }
+    return std::realloc(ptr, size);
+}
+
+void CountingFree(void *ptr) {
+    std::free(ptr);
+}
+
+} // namespace
+
+void *operator new(size_t size) {
+    if (void *ptr = CountingMalloc(size ? size : 1)) {
+        return ptr;
+    }
+    throw std::bad_alloc{};
+}
+
+void operator delete(void *ptr) noexcept {
+    CountingFree(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    CountingFree(ptr);
+}
+
+namespace {
+
+struct Options {
+    size_t count = 20000;
+    size_t concurrency = 64;
+    size_t unique = 0; /* 0: every name distinct, nothing coalesces */
+    std::chrono::milliseconds latency{0};
+    double loss = 0.0;
+    double truncate = 0.0;
+    std::vector<unsigned> threads{1, 4};
+    std::vector<cares::detail::resolve_mode> modes{cares::detail::ipv4_only, cares::detail::both};
+    bool ares_arena = false;
+};
+
+/*
+ * Answers A and AAAA for every name, NXDOMAIN for names starting with
+ * "nx". Runs on its own thread with its own io_context.
+ */
+class FakeDnsServer {
+public:
+    explicit FakeDnsServer(const Options &options)
+        : options_(options), udp_(context_, {boost::asio::ip::address_v4::loopback(), 0}),
+          acceptor_(context_, {boost::asio::ip::address_v4::loopback(), udp_.local_endpoint().port()}),
+          random_(42) {
+        ReceiveUdp();
+        Accept();
+        thread_ = std::thread([this]() {
+            count_allocations = false;
+            context_.run();
+        });
+    }
+
+    ~FakeDnsServer() {
+        context_.stop();
+        thread_.join();
+    }
+
+    uint16_t Port() const {
+        return udp_.local_endpoint().port();
+    }
+
+private:
+    using buffer_type = std::vector<unsigned char>;
+
+    void ReceiveUdp() {
+        udp_.async_receive_from(
+            boost::asio::buffer(receive_), peer_,
+            [this](boost::system::error_code ec, size_t length) {
+                if (ec) {
+                    return;
+                }
+                buffer_type query(receive_.begin(), receive_.begin() + length);
+                if (!Chance(options_.loss)) {
+                    auto reply = std::make_shared<buffer_type>(Answer(query, Chance(options_.truncate)));
+                    auto peer = peer_;
+                    Delay([this, reply, peer]() {
+                        udp_.async_send_to(boost::asio::buffer(*reply), peer, [reply](boost::system::error_code, size_t) {});
+                    });
+                }
+                ReceiveUdp();
+            }
+        );
+    }
+
+    void Accept() {
+        auto socket = std::make_shared<boost::asio::ip::tcp::socket>(context_);
+        acceptor_.async_accept(*socket, [this, socket](boost::system::error_code ec) {
+            if (ec) {
+                return;
+            }
+            ReadTcp(socket);
+            Accept();
+        });
+    }
+
+    void ReadTcp(std::shared_ptr<boost::asio::ip::tcp::socket> socket) {
+        auto length = std::make_shared<std::array<unsigned char, 2>>();
+        boost::asio::async_read(*socket, boost::asio::buffer(*length), [this, socket, length](boost::system::error_code ec, size_t) {
+            if (ec) {
+                return;
+            }
+            auto query = std::make_shared<buffer_type>(((*length)[0] << 8) | (*length)[1]);
+            boost::asio::async_read(*socket, boost::asio::buffer(*query), [this, socket, query](boost::system::error_code ec, size_t) {
+                if (ec) {
+                    return;
+                }
+                auto answer = Answer(*query, false);
+                auto reply = std::make_shared<buffer_type>();
+                reply->push_back(static_cast<unsigned char>(answer.size() >> 8));
+                reply->push_back(static_cast<unsigned char>(answer.size() & 0xff));
+                reply->insert(reply->end(), answer.begin(), answer.end());
+                Delay([socket, reply]() {
+                    boost::asio::async_write(*socket, boost::asio::buffer(*reply), [socket, reply](boost::system::error_code, size_t) {});
+                });
+                ReadTcp(socket);
+            });
+        });
+    }
+
+    template<class Function>
+    void Delay(Function function) {
+        if (options_.latency.count() <= 0) {
+            function();
+            return;
+        }
+        auto timer = std::make_shared<boost::asio::steady_timer>(context_, options_.latency);
+        timer->async_wait([timer, function](boost::system::error_code) { function(); });
+    }
+
+    bool Chance(double probability) {
+        return probability > 0 && std::uniform_real_distribution<double>{0, 1}(random_) < probability;
+    }
+
+    /* header and question copied, one answer record or none */
+    static buffer_type Answer(const buffer_type &query, bool truncated) {
+        if (query.size() < 12) {
+            return {};
+        }
+        size_t pos = 12;
+        std::string first_label;
+        while (pos < query.size() && query[pos] != 0) {
+            if (first_label.empty()) {
+                first_label.assign(query.begin() + pos + 1, query.begin() + pos + 1 + query[pos]);
+            }
+            pos += query[pos] + 1;
+        }
+        pos += 1;
+        if (pos + 4 > query.size()) {
+            return {};
+        }
+        unsigned type = (query[pos] << 8) | query[pos + 1];
+        pos += 4;
+
+        buffer_type reply(query.begin(), query.begin() + pos);
+        bool nx = first_label.compare(0, 2, "nx") == 0;
+        bool answer = !nx && !truncated && (type == 1 || type == 28);
+        reply[2] = static_cast<unsigned char>(0x80 | (query[2] & 0x01) | (truncated ? 0x02 : 0));
+        reply[3] = static_cast<unsigned char>(0x80 | (nx ? 3 : 0));
+        reply[6] = reply[8] = reply[9] = reply[10] = reply[11] = 0;
+        reply[7] = answer ? 1 : 0;
+        if (!answer) {
+            return reply;
+        }
+        unsigned char record[] = {0xc0, 0x0c, 0, static_cast<unsigned char>(type), 0, 1, 0, 0, 0, 60, 0,
+                                  static_cast<unsigned char>(type == 1 ? 4 : 16)};
+        reply.insert(reply.end(), std::begin(record), std::end(record));
+        if (type == 1) {
+            unsigned char v4[] = {10, 0, 0, 1};
+            reply.insert(reply.end(), std::begin(v4), std::end(v4));
+        } else {
+            unsigned char v6[16] = {0xfd, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+            reply.insert(reply.end(), std::begin(v6), std::end(v6));
+        }
+        return reply;
+    }
+
+    const Options &options_;
+    boost::asio::io_context context_;
+    boost::asio::ip::udp::socket udp_;
+    boost::asio::ip::tcp::acceptor acceptor_;
+    boost::asio::ip::udp::endpoint peer_;
+    std::array<unsigned char, 512> receive_;
+    std::mt19937 random_;
+    std::thread thread_;
+};
+
+struct Result {
+    double seconds;
+    uint64_t errors;
+    uint64_t allocations;
+    cares::latency_histogram latency;
+};
+
+/* closed loop: concurrency lookups outstanding until count have completed */
+template<class Resolver>
+class Driver {
+public:
+    Driver(Resolver &resolver, const Options &options)
+        : resolver_(resolver), options_(options), issued_(0), errors_(0) {
+    }
+
+    void Start() {
+        for (size_t i = 0; i < options_.concurrency && i < options_.count; ++i) {
+            Next();
+        }
+    }
+
+    uint64_t Errors() const {
+        return errors_;
+    }
+
+    const cares::detail::LatencyHistogram &Latency() const {
+        return latency_;
+    }
+
+private:
+    void Next() {
+        auto seq = issued_.fetch_add(1);
+        if (seq >= options_.count) {
+            return;
+        }
+        auto unique = options_.unique ? options_.unique : options_.count;
+        auto started = std::chrono::steady_clock::now();
+        resolver_.async_resolve(
+            "h" + std::to_string(seq % unique) + ".bench", 80,
+            [this, started](boost::system::error_code ec, typename Resolver::results_type) {
+                latency_.Record(std::chrono::steady_clock::now() - started);
+                if (ec) {
+                    errors_.fetch_add(1, std::memory_order_relaxed);
+                }
+                Next();
+            }
+        );
+    }
+
+    Resolver &resolver_;
+    const Options &options_;
+    std::atomic<size_t> issued_;
+    std::atomic<uint64_t> errors_;
+    cares::detail::LatencyHistogram latency_;
+};
+
+void Configure(cares::tcp::resolver &resolver, const std::string &server, cares::detail::resolve_mode mode, unsigned, std::vector<std::unique_ptr<boost::asio::io_context>> &) {
+    boost::system::error_code ec;
+    resolver.set_servers(server, ec);
+    resolver.resolve_mode(mode, ec);
+}
+
+void Configure(cares::tcp::pooled_resolver &resolver, const std::string &server, cares::detail::resolve_mode mode, unsigned threads,
+               std::vector<std::unique_ptr<boost::asio::io_context>> &contexts) {
+    std::vector<boost::asio::io_context *> pointers;
+    for (unsigned i = 0; i < threads; ++i) {
+        contexts.emplace_back(new boost::asio::io_context{1});
+        pointers.push_back(contexts.back().get());
+    }
+    resolver.set_contexts(pointers);
+    boost::system::error_code ec;
+    resolver.set_servers(server, ec);
+    resolver.resolve_mode(mode, ec);
+}
+
+template<class Resolver>
+Result Run(const Options &options, uint16_t port, cares::detail::resolve_mode mode, unsigned threads) {
+    boost::asio::io_context context;
+    std::vector<std::unique_ptr<boost::asio::io_context>> channel_contexts;
+    Resolver resolver{context};
+    Configure(resolver, "127.0.0.1:" + std::to_string(port), mode, threads, channel_contexts);
+
+    /* channel contexts of a pool, each on its own thread */
+    std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+    std::vector<std::thread> pool_threads;
+    for (auto &channel_context : channel_contexts) {
+        work.emplace_back(boost::asio::make_work_guard(*channel_context));
+        auto *pointer = channel_context.get();
+        pool_threads.emplace_back([pointer]() { pointer->run(); });
+    }
+
+    Driver<Resolver> driver{resolver, options};
+    auto allocations_before = allocations.load();
+    auto started = std::chrono::steady_clock::now();
+    driver.Start();
+    std::vector<std::thread> runners;
+    for (unsigned i = 1; i < threads; ++i) {
+        runners.emplace_back([&context]() { context.run(); });
+    }
+    context.run();
+    for (auto &runner : runners) {
+        runner.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - started;
+    auto allocated = allocations.load() - allocations_before;
+
+    work.clear();
+    for (auto &thread : pool_threads) {
+        thread.join();
+    }
+    return Result{std::chrono::duration<double>(elapsed).count(), driver.Errors(), allocated, driver.Latency().Snapshot()};
+}
+
+void Report(const Options &options, const char *kind, cares::detail::resolve_mode mode, unsigned threads, const Result &result) {
+    static const char *mode_names[] = {"unspecific", "ipv4_first", "ipv4_only", "ipv6_first", "ipv6_only", "both", "rfc6724"};
+    std::printf("%-7s %-11s %7u %12.0f %10lld %10lld %10lld %10.1f %8llu\n",
+                kind, mode_names[mode], threads,
+                static_cast<double>(options.count) / result.seconds,
+                static_cast<long long>(result.latency.Percentile(50).count()),
+                static_cast<long long>(result.latency.Percentile(99).count()),
+                static_cast<long long>(result.latency.Max().count()),
+                static_cast<double>(result.allocations) / static_cast<double>(options.count),
+                static_cast<unsigned long long>(result.errors));
+    std::fflush(stdout);
+}
+
+template<class T, class Parse>
+std::vector<T> ParseList(const std::string &value, Parse parse) {
+    std::vector<T> list;
+    size_t begin = 0;
+    while (begin <= value.size()) {
+        auto end = value.find(',', begin);
+        if (end == std::string::npos) {
+            end = value.size();
+        }
+        if (end > begin) {
+            list.push_back(parse(value.substr(begin, end - begin)));
+        }
+        begin = end + 1;
+    }
+    return list;
+}
+
+bool ParseOptions(int argc, char **argv, Options &options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg{argv[i]};
+        auto eq = arg.find('=');
+        auto key = arg.substr(0, eq);
+        auto value = (eq == std::string::npos) ? std::string{} : arg.substr(eq + 1);
+        if (key == "--count") {
+            options.count = std::stoul(value);
+        } else if (key == "--concurrency") {
+            options.concurrency = std::stoul(value);
+        } else if (key == "--unique") {
+            options.unique = std::stoul(value);
+        } else if (key == "--latency-ms") {
+            options.latency = std::chrono::milliseconds{std::stol(value)};
+        } else if (key == "--loss") {
+            options.loss = std::stod(value);
+        } else if (key == "--truncate") {
+            options.truncate = std::stod(value);
+        } else if (key == "--threads") {
+            options.threads = ParseList<unsigned>(value, [](const std::string &s) { return static_cast<unsigned>(std::stoul(s)); });
+        } else if (key == "--ares-arena") {
+            options.ares_arena = true;
+        } else if (key == "--modes") {
+            bool valid = true;
+            options.modes = ParseList<cares::detail::resolve_mode>(value, [&valid](const std::string &s) {
+                cares::detail::resolve_mode mode = cares::detail::both;
+                valid = cares::detail::resolve_mode_from_string(s, mode) && valid;
+                return mode;
+            });
+            if (!valid) {
+                return false;
+            }
+        } else {
+            return false;
+        }
+    }
+    return options.count > 0 && options.concurrency > 0 && !options.threads.empty() && !options.modes.empty();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::fprintf(stderr, "usage: %s [--count=N] [--concurrency=N] [--unique=N] [--latency-ms=N] "
+                             "[--loss=P] [--truncate=P] [--threads=1,4] [--modes=ipv4_only,both] [--ares-arena]\n", argv[0]);
+        return 2;
+    }
+    /* c-ares allocations are counted too, the arena takes its blocks from the counted operator new */
+    int ret = options.ares_arena
+        ? ::ares_library_init_mem(ARES_LIB_INIT_ALL, cares::detail::AresMalloc, cares::detail::AresFree, cares::detail::AresRealloc)
+        : ::ares_library_init_mem(ARES_LIB_INIT_ALL, CountingMalloc, CountingFree, CountingRealloc);
+    if (ret != ARES_SUCCESS) {
+        std::fprintf(stderr, "ares_library_init_mem failed\n");
+        return 1;
+    }
+
+    FakeDnsServer server{options};
+    std::printf("%zu resolves, %zu outstanding, latency %lldms, loss %.2f, truncate %.2f, ares arena %s\n",
+                options.count, options.concurrency, static_cast<long long>(options.latency.count()), options.loss, options.truncate,
+                options.ares_arena ? "on" : "off");
+    std::printf("%-7s %-11s %7s %12s %10s %10s %10s %10s %8s\n",
+                "channel", "mode", "threads", "resolves/s", "p50(us)", "p99(us)", "max(us)", "allocs/op", "errors");
+    for (auto mode : options.modes) {
+        for (auto threads : options.threads) {
+            Report(options, "single", mode, threads, Run<cares::tcp::resolver>(options, server.Port(), mode, threads));
+            Report(options, "pooled", mode, threads, Run<cares::tcp::pooled_resolver>(options, server.Port(), mode, threads));
+        }
+    }
+    ::ares_library_cleanup();
+    return 0;
+}
@@ -3,6 +3,7 @@
 
 #include "detail/io_object.hxx"
 #include "detail/service.hxx"
+#include "detail/channel_pool.hxx"
 #include "detail/error.hxx"
 
 namespace cares {
@@ -10,15 +11,53 @@ namespace cares {
 template<class Protocol>
 using resolver = detail::basic_cares_resolver<detail::base_cares_service<Protocol>>;
 
+using select_by_name = detail::HashSelect;
+using select_round_robin = detail::RoundRobinSelect;
+
+template<class Protocol, class Select = select_by_name>
+using pooled_resolver = detail::basic_cares_resolver<detail::base_cares_service<Protocol, detail::ChannelPool<Select>>>;
+
+/* Trace gets every lifecycle step of a resolve, see detail::NoTrace */
+template<class Protocol, class Trace>
+using traced_resolver = detail::basic_cares_resolver<detail::base_cares_service<Protocol, detail::BasicChannel<Trace>, Trace>>;
+
+/* Mode for the resolver's whole life, single query modes then skip the merge step */
+template<class Protocol, detail::resolve_mode Mode>
+using fixed_resolver = detail::basic_cares_resolver<detail::base_cares_service<Protocol, detail::Channel, detail::NoTrace, detail::FixedMode<Mode>>>;
+
 namespace tcp {
 using resolver = ::cares::resolver<boost::asio::ip::tcp>;
+using pooled_resolver = ::cares::pooled_resolver<boost::asio::ip::tcp>;
+template<detail::resolve_mode Mode>
+using fixed_resolver = ::cares::fixed_resolver<boost::asio::ip::tcp, Mode>;
 } // namespace tcp
 
 namespace udp {
 using resolver = ::cares::resolver<boost::asio::ip::udp>;
+using pooled_resolver = ::cares::pooled_resolver<boost::asio::ip::udp>;
+template<detail::resolve_mode Mode>
+using fixed_resolver = ::cares::fixed_resolver<boost::asio::ip::udp, Mode>;
 } // namespace udp
 
+using srv = detail::SrvRecord;
+using txt = detail::TxtRecord;
+using mx = detail::MxRecord;
+using ptr = detail::PtrRecord;
+using query_scope = detail::query_scope;
+template<class Record>
+using record_set = detail::RecordSet<Record>;
+
+using cache = detail::ResolveCache;
+using hosts = detail::HostsTable;
+using stats = detail::StatsSnapshot;
+using latency_histogram = detail::HistogramSnapshot;
+using trace_event = detail::TraceEvent;
+using trace_stage = detail::trace_stage;
+using no_trace = detail::NoTrace;
+using request_handle = detail::RequestHandle;
+
 using detail::available_resolve_modes;
+using detail::use_recycling_allocator;
 
 } // namespace cares
 
@@ -0,0 +1,318 @@
+#ifndef __CARES_SERVICES_ARENA_HXX__
+#define __CARES_SERVICES_ARENA_HXX__
+
+#include <array>
+#include <mutex>
+#include <memory>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include <boost/asio.hpp>
+#include <ares.h>
+
+#include "error.hxx"
+
+namespace cares {
+namespace detail {
+
+/*
+ * Free lists of power-of-two blocks from 32 bytes to 4k. Freed blocks are
+ * kept for the next request of the same class, so once the busiest moment
+ * has been seen, resolving stops calling malloc. Larger blocks, and blocks
+ * beyond kMaxCached per class, go straight back to the heap.
+ *
+ * Every thread keeps its own lists, shared by all arenas, so the common
+ * case takes no lock. A thread that runs dry takes kBatch blocks from the
+ * arena's shared lists at once, one that has too many hands kBatch back.
+ */
+class RecyclingArena {
+public:
+    static constexpr size_t kMinBlock = 32;
+    static constexpr size_t kClasses = 8;
+    static constexpr size_t kMaxBlock = kMinBlock << (kClasses - 1);
+    static constexpr size_t kMaxCached = 1024;
+    static constexpr size_t kThreadCached = 256;
+    static constexpr size_t kBatch = 64;
+
+    RecyclingArena() = default;
+
+    RecyclingArena(const RecyclingArena &) = delete;
+    RecyclingArena &operator=(const RecyclingArena &) = delete;
+
+    ~RecyclingArena() {
+        for (auto &list : shared_) {
+            list.Release();
+        }
+    }
+
+    void *Allocate(size_t size) {
+        if (size > kMaxBlock) {
+            return ::operator new(size);
+        }
+        auto index = ClassOf(size);
+        if (auto *cache = LocalCache()) {
+            auto &list = cache->lists[index];
+            if (list.IsEmpty()) {
+                std::lock_guard<std::mutex> lock{mutex_};
+                shared_[index].MoveTo(list, kBatch);
+            }
+            if (auto *block = list.Pop()) {
+                return block;
+            }
+        } else {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (auto *block = shared_[index].Pop()) {
+                return block;
+            }
+        }
+        return ::operator new(kMinBlock << index);
+    }
+
+    void Deallocate(void *ptr, size_t size) {
+        if (!ptr) {
+            return;
+        }
+        if (size > kMaxBlock) {
+            ::operator delete(ptr);
+            return;
+        }
+        auto index = ClassOf(size);
+        FreeList spill;
+        if (auto *cache = LocalCache()) {
+            auto &list = cache->lists[index];
+            list.Push(static_cast<Block *>(ptr));
+            if (list.Size() <= kThreadCached) {
+                return;
+            }
+            list.MoveTo(spill, kBatch);
+        } else {
+            spill.Push(static_cast<Block *>(ptr));
+        }
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            auto &shared = shared_[index];
+            if (shared.Size() < kMaxCached) {
+                spill.MoveTo(shared, kMaxCached - shared.Size());
+            }
+        }
+        spill.Release();
+    }
+
+    /* what Allocate(size) really hands out */
+    static size_t Capacity(size_t size) {
+        return size > kMaxBlock ? size : (kMinBlock << ClassOf(size));
+    }
+
+private:
+    struct Block {
+        Block *next;
+    };
+
+    class FreeList {
+    public:
+        bool IsEmpty() const {
+            return !head_;
+        }
+
+        size_t Size() const {
+            return size_;
+        }
+
+        void Push(Block *block) {
+            block->next = head_;
+            head_ = block;
+            ++size_;
+        }
+
+        Block *Pop() {
+            auto *block = head_;
+            if (block) {
+                head_ = block->next;
+                --size_;
+            }
+            return block;
+        }
+
+        /* up to count blocks from the front of this list onto other */
+        void MoveTo(FreeList &other, size_t count) {
+            for (; count != 0 && head_; --count) {
+                other.Push(Pop());
+            }
+        }
+
+        void Release() {
+            while (auto *block = Pop()) {
+                ::operator delete(block);
+            }
+        }
+
+    private:
+        Block *head_ = nullptr;
+        size_t size_ = 0;
+    };
+
+    struct ThreadCache {
+        explicit ThreadCache(bool &finished)
+            : finished(finished) {
+        }
+
+        ~ThreadCache() {
+            for (auto &list : lists) {
+                list.Release();
+            }
+            finished = true;
+        }
+
+        std::array<FreeList, kClasses> lists;
+        bool &finished;
+    };
+
+    /* null once the thread's cache is gone, c-ares may still free at exit */
+    static ThreadCache *LocalCache() {
+        static thread_local bool finished = false;
+        if (finished) {
+            return nullptr;
+        }
+        static thread_local ThreadCache cache{finished};
+        return &cache;
+    }
+
+    static size_t ClassOf(size_t size) {
+        size_t index = 0;
+        while ((kMinBlock << index) < size) {
+            ++index;
+        }
+        return index;
+    }
+
+    std::mutex mutex_;
+    std::array<FreeList, kClasses> shared_;
+};
+
+/* standard allocator on top of a RecyclingArena, copies share the arena */
+template<class T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(std::shared_ptr<RecyclingArena> arena)
+        : arena_(std::move(arena)) {
+    }
+
+    template<class U>
+    ArenaAllocator(const ArenaAllocator<U> &other)
+        : arena_(other.GetArena()) {
+    }
+
+    T *allocate(size_t n) {
+        return static_cast<T *>(arena_->Allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T *ptr, size_t n) {
+        arena_->Deallocate(ptr, n * sizeof(T));
+    }
+
+    const std::shared_ptr<RecyclingArena> &GetArena() const {
+        return arena_;
+    }
+
+    template<class U>
+    bool operator==(const ArenaAllocator<U> &other) const {
+        return arena_ == other.GetArena();
+    }
+
+    template<class U>
+    bool operator!=(const ArenaAllocator<U> &other) const {
+        return arena_ != other.GetArena();
+    }
+
+private:
+    std::shared_ptr<RecyclingArena> arena_;
+};
+
+/* gives a posted function an associated allocator, asio then takes its operation memory from there */
+template<class Function>
+struct ArenaHandler {
+    using allocator_type = ArenaAllocator<void>;
+
+    allocator_type get_allocator() const noexcept {
+        return allocator;
+    }
+
+    template<class... Args>
+    void operator()(Args &&...args) {
+        function(std::forward<Args>(args)...);
+    }
+
+    Function function;
+    allocator_type allocator;
+};
+
+template<class Function>
+ArenaHandler<typename std::decay<Function>::type> BindArena(const std::shared_ptr<RecyclingArena> &arena, Function &&function) {
+    return {std::forward<Function>(function), ArenaAllocator<void>{arena}};
+}
+
+/*
+ * c-ares allocations only come with a pointer, so each block carries its
+ * size in front. One arena serves every channel, its thread caches keep
+ * the lock off the common path. It is never destroyed since c-ares may
+ * free memory during static destruction.
+ */
+inline RecyclingArena &AresArena() {
+    static auto *arena = new RecyclingArena{};
+    return *arena;
+}
+
+static constexpr size_t kAresHeader = alignof(std::max_align_t);
+
+inline void *AresMalloc(size_t size) {
+    auto *block = static_cast<unsigned char *>(AresArena().Allocate(size + kAresHeader));
+    memcpy(block, &size, sizeof size);
+    return block + kAresHeader;
+}
+
+inline void AresFree(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+    auto *block = static_cast<unsigned char *>(ptr) - kAresHeader;
+    size_t size;
+    memcpy(&size, block, sizeof size);
+    AresArena().Deallocate(block, size + kAresHeader);
+}
+
+inline void *AresRealloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return AresMalloc(size);
+    }
+    auto *block = static_cast<unsigned char *>(ptr) - kAresHeader;
+    size_t old_size;
+    memcpy(&old_size, block, sizeof old_size);
+    if (RecyclingArena::Capacity(old_size + kAresHeader) >= size + kAresHeader && size + kAresHeader <= RecyclingArena::kMaxBlock) {
+        memcpy(block, &size, sizeof size);
+        return ptr;
+    }
+    auto *result = AresMalloc(size);
+    memcpy(result, ptr, std::min(old_size, size));
+    AresFree(ptr);
+    return result;
+}
+
+/*
+ * Routes c-ares' own allocations through the recycling arena. c-ares keeps
+ * one set of allocator functions for the whole process, so call this once
+ * before creating any resolver or other c-ares user.
+ */
+inline void use_recycling_allocator(boost::system::error_code &ec) {
+    ec.clear();
+    int ret = ::ares_library_init_mem(ARES_LIB_INIT_ALL, AresMalloc, AresFree, AresRealloc);
+    if (ret != ARES_SUCCESS) {
+        ec.assign(ret, error::get_category());
+    }
+}
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_ARENA_HXX__
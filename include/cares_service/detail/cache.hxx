@@ -0,0 +1,453 @@
+#ifndef __CARES_SERVICES_CACHE_HXX__
+#define __CARES_SERVICES_CACHE_HXX__
+
+#include <list>
+#include <array>
+#include <mutex>
+#include <cctype>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <fstream>
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+#include "error.hxx"
+#include "resolve_mode.hxx"
+
+namespace cares {
+namespace detail {
+
+class ResolveCache {
+public:
+    using clock_type = std::chrono::steady_clock;
+    using address_list = std::vector<boost::asio::ip::address>;
+
+    struct Options {
+        size_t max_entries = 4096;
+        std::chrono::seconds min_ttl{0};
+        std::chrono::seconds max_ttl{3600};
+        /* NXDOMAIN/NODATA answers are kept this long, 0 disables negative caching */
+        std::chrono::seconds negative_ttl{30};
+        /*
+         * Refresh-ahead: an answer served within this last fraction of its ttl,
+         * after at least refresh_min_hits hits, is fetched again in the
+         * background while the old one keeps being served. 0 disables it.
+         */
+        double refresh_ahead = 0.0;
+        uint32_t refresh_min_hits = 4;
+        /*
+         * Serve-stale (RFC 8767): expired answers are kept stale_window longer
+         * and handed out when upstream fails, 0 disables it. A lookup that
+         * has stale data and no answer after stale_answer_timeout completes
+         * with the stale data, 0 waits for the channel timeout.
+         */
+        std::chrono::seconds stale_window{0};
+        std::chrono::milliseconds stale_answer_timeout{0};
+        /*
+         * Warm start: when set, the cache is preloaded from this snapshot on
+         * construction and writes it back on destruction. Call Save() on a
+         * timer to keep it fresh in between.
+         */
+        std::string snapshot_path;
+    };
+
+    ResolveCache(const ResolveCache &) = delete;
+    ResolveCache()
+        : ResolveCache(Options{}) {
+    }
+
+    explicit ResolveCache(Options options)
+        : options_(options), hits_(0), misses_(0), stale_hits_(0) {
+        if (!options_.snapshot_path.empty()) {
+            boost::system::error_code ec;
+            Load(options_.snapshot_path, ec); /* no snapshot yet is a cold start */
+        }
+    }
+
+    ~ResolveCache() {
+        if (!options_.snapshot_path.empty()) {
+            boost::system::error_code ec;
+            Save(options_.snapshot_path, ec);
+        }
+    }
+
+    /* failures of the servers rather than answers about the name, or no room to ask them */
+    static bool IsUpstreamFailure(const boost::system::error_code &ec) {
+        if (ec.category() != error::get_category()) {
+            return false;
+        }
+        switch (ec.value()) {
+        case error::timeout:
+        case error::serve_failed:
+        case error::query_refused:
+        case error::connection_refused:
+        case error::bad_response:
+        case error::malformat:
+        case error::eof:
+        case error::overloaded:
+            return true;
+        default:
+            return false;
+        }
+    }
+
+    bool Lookup(const std::string &name, resolve_mode mode, address_list &addresses, boost::system::error_code &ec) {
+        bool refresh;
+        return Lookup(name, mode, addresses, ec, refresh);
+    }
+
+    /* refresh is set for the one caller that should start the background refresh */
+    bool Lookup(const std::string &name, resolve_mode mode, address_list &addresses, boost::system::error_code &ec, bool &refresh) {
+        refresh = false;
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto itr = index_.find(Key{name, mode});
+        if (itr == index_.end()) {
+            ++misses_;
+            return false;
+        }
+        if (itr->second->expiry <= now) {
+            /* still good for LookupStale */
+            if (itr->second->error || itr->second->expiry + options_.stale_window <= now) {
+                entries_.erase(itr->second);
+                index_.erase(itr);
+            }
+            ++misses_;
+            return false;
+        }
+        entries_.splice(entries_.begin(), entries_, itr->second);
+        auto &entry = *itr->second;
+        addresses = entry.addresses;
+        ec = entry.error;
+        ++hits_;
+        ++entry.hits;
+        if (options_.refresh_ahead > 0 && !entry.error && !entry.refreshing && entry.hits >= options_.refresh_min_hits) {
+            auto window = std::chrono::duration_cast<clock_type::duration>(entry.ttl * options_.refresh_ahead);
+            if (entry.expiry - now <= window) {
+                entry.refreshing = true;
+                refresh = true;
+            }
+        }
+        return true;
+    }
+
+    /* any positive answer that is at most stale_window past its expiry */
+    bool LookupStale(const std::string &name, resolve_mode mode, address_list &addresses) {
+        if (options_.stale_window.count() <= 0) {
+            return false;
+        }
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto itr = index_.find(Key{name, mode});
+        if (itr == index_.end() || itr->second->error || itr->second->expiry + options_.stale_window <= now) {
+            return false;
+        }
+        addresses = itr->second->addresses;
+        ++stale_hits_;
+        return true;
+    }
+
+    /* the background refresh failed, the old answer stays until it expires */
+    void AbortRefresh(const std::string &name, resolve_mode mode) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto itr = index_.find(Key{name, mode});
+        if (itr != index_.end()) {
+            itr->second->refreshing = false;
+        }
+    }
+
+    template<class Endpoints>
+    void Insert(const std::string &name, resolve_mode mode, const Endpoints &endpoints, std::chrono::seconds ttl) {
+        if (options_.max_entries == 0) {
+            return;
+        }
+        address_list addresses;
+        for (auto &ep : endpoints) {
+            addresses.push_back(ep.address());
+        }
+        if (addresses.empty()) {
+            return;
+        }
+        ttl = std::min(std::max(ttl, options_.min_ttl), options_.max_ttl);
+        Store(Key{name, mode}, std::move(addresses), boost::system::error_code{}, ttl);
+    }
+
+    /* only name errors are cached, transient failures always go upstream */
+    void InsertError(const std::string &name, resolve_mode mode, boost::system::error_code ec) {
+        if (options_.max_entries == 0 || options_.negative_ttl.count() <= 0) {
+            return;
+        }
+        if (ec.category() != error::get_category() ||
+            (ec.value() != error::not_found && ec.value() != error::no_data)) {
+            return;
+        }
+        Store(Key{name, mode}, address_list{}, ec, options_.negative_ttl);
+    }
+
+    /*
+     * Writes the positive answers, most recently used first, to path. The
+     * file is written aside and renamed into place, so a process loading it
+     * concurrently sees either the old snapshot or the new one.
+     */
+    void Save(const std::string &path, boost::system::error_code &ec) const {
+        ec.clear();
+        std::string data{SnapshotMagic(), kSnapshotMagicSize};
+        PutInt(data, kSnapshotVersion, 4);
+        data.append(4, '\0'); /* record count, filled in below */
+        uint32_t count = 0;
+        auto wall_now = std::chrono::system_clock::now();
+        auto now = clock_type::now();
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            for (auto &entry : entries_) {
+                if (entry.error || entry.expiry + options_.stale_window <= now || entry.key.name.size() > 255) {
+                    continue;
+                }
+                auto expiry = wall_now + std::chrono::duration_cast<std::chrono::system_clock::duration>(entry.expiry - now);
+                auto seconds = std::chrono::duration_cast<std::chrono::seconds>(expiry.time_since_epoch()).count();
+                auto addresses = std::min<size_t>(entry.addresses.size(), 255);
+                PutInt(data, static_cast<uint64_t>(seconds), 8);
+                PutInt(data, std::chrono::duration_cast<std::chrono::seconds>(entry.ttl).count(), 4);
+                PutInt(data, static_cast<uint8_t>(entry.key.mode), 1);
+                PutInt(data, entry.key.name.size(), 1);
+                PutInt(data, addresses, 1);
+                data.append(entry.key.name);
+                for (size_t i = 0; i < addresses; ++i) {
+                    PutAddress(data, entry.addresses[i]);
+                }
+                ++count;
+            }
+        }
+        for (size_t i = 0; i < 4; ++i) {
+            data[kSnapshotMagicSize + 4 + i] = static_cast<char>((count >> (8 * i)) & 0xff);
+        }
+
+        auto temp = path + ".tmp";
+        {
+            std::ofstream file{temp, std::ios::binary | std::ios::trunc};
+            if (!file.write(data.data(), data.size()) || !file.flush()) {
+                ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+                std::remove(temp.c_str());
+                return;
+            }
+        }
+#if defined(_WIN32)
+        std::remove(path.c_str());
+#endif
+        if (std::rename(temp.c_str(), path.c_str()) != 0) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::io_error);
+            std::remove(temp.c_str());
+        }
+    }
+
+    /*
+     * Adds the answers of a snapshot written by Save(). They keep whatever
+     * is left of their ttl and are fetched again once that runs out, names
+     * already in the cache are left alone.
+     */
+    void Load(const std::string &path, boost::system::error_code &ec) {
+        ec.clear();
+        std::ifstream file{path, std::ios::binary};
+        if (!file) {
+            ec = boost::system::errc::make_error_code(boost::system::errc::no_such_file_or_directory);
+            return;
+        }
+        std::string data{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        auto bad_file = boost::system::errc::make_error_code(boost::system::errc::invalid_argument);
+        size_t pos = kSnapshotMagicSize;
+        if (data.size() < pos + 8 || data.compare(0, pos, SnapshotMagic(), pos) != 0 ||
+            GetInt(data, pos, 4) != kSnapshotVersion) {
+            ec = bad_file;
+            return;
+        }
+        auto count = GetInt(data, pos, 4);
+
+        auto wall_now = std::chrono::system_clock::now();
+        auto now = clock_type::now();
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (uint64_t i = 0; i < count; ++i) {
+            if (data.size() < pos + 15) {
+                ec = bad_file;
+                return;
+            }
+            auto seconds = static_cast<int64_t>(GetInt(data, pos, 8));
+            auto ttl = std::chrono::seconds{GetInt(data, pos, 4)};
+            auto mode_value = GetInt(data, pos, 1);
+            auto name_length = GetInt(data, pos, 1);
+            auto addresses = GetInt(data, pos, 1);
+            if (mode_value >= resolve_mode_count || data.size() < pos + name_length + addresses * kSnapshotAddress) {
+                ec = bad_file;
+                return;
+            }
+            Key key{data.substr(pos, name_length), static_cast<resolve_mode>(mode_value)};
+            pos += name_length;
+            address_list list;
+            for (uint64_t j = 0; j < addresses; ++j) {
+                list.push_back(GetAddress(data, pos));
+            }
+
+            auto expiry = std::chrono::system_clock::time_point{std::chrono::seconds{seconds}};
+            auto remaining = std::chrono::duration_cast<clock_type::duration>(expiry - wall_now);
+            if (list.empty() || remaining + options_.stale_window <= clock_type::duration::zero() ||
+                index_.size() >= options_.max_entries || index_.count(key) != 0) {
+                continue;
+            }
+            /* the file is most recently used first, so keep appending */
+            entries_.push_back(Entry{std::move(key), std::move(list), boost::system::error_code{}, now + remaining, ttl, 0, false});
+            index_.emplace(entries_.back().key, std::prev(entries_.end()));
+        }
+    }
+
+    void Clear() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        index_.clear();
+        entries_.clear();
+    }
+
+    size_t Size() const {
+        std::lock_guard<std::mutex> lock{mutex_};
+        return index_.size();
+    }
+
+    uint64_t Hits() const {
+        return hits_;
+    }
+
+    uint64_t Misses() const {
+        return misses_;
+    }
+
+    uint64_t StaleHits() const {
+        return stale_hits_;
+    }
+
+    const Options &GetOptions() const {
+        return options_;
+    }
+
+private:
+    struct Key {
+        std::string name;
+        resolve_mode mode;
+
+        Key(const std::string &n, resolve_mode m)
+            : name(n), mode(m) {
+            /* domain names are case-insensitive */
+            std::transform(name.begin(), name.end(), name.begin(),
+                           [](unsigned char c) { return std::tolower(c); });
+        }
+
+        bool operator==(const Key &other) const {
+            return mode == other.mode && name == other.name;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key &key) const {
+            return std::hash<std::string>{}(key.name) ^ (static_cast<size_t>(key.mode) << 1);
+        }
+    };
+
+    struct Entry {
+        Key key;
+        address_list addresses;
+        boost::system::error_code error;
+        clock_type::time_point expiry;
+        clock_type::duration ttl;
+        uint32_t hits;
+        bool refreshing;
+    };
+
+    using entry_list = std::list<Entry>;
+
+    /*
+     * Snapshot layout, integers little-endian: magic, version, record count,
+     * then per record expiry (unix seconds, 8), ttl (4), mode (1), name
+     * length (1), address count (1), the name, and the addresses as family
+     * (1) plus 16 bytes each.
+     */
+    static constexpr size_t kSnapshotMagicSize = 8;
+    static constexpr uint32_t kSnapshotVersion = 1;
+    static constexpr size_t kSnapshotAddress = 17;
+
+    static const char *SnapshotMagic() {
+        return "CARESSNP";
+    }
+
+    static void PutInt(std::string &data, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            data.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    }
+
+    static uint64_t GetInt(const std::string &data, size_t &pos, size_t size) {
+        uint64_t value = 0;
+        for (size_t i = 0; i < size; ++i) {
+            value |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos++])) << (8 * i);
+        }
+        return value;
+    }
+
+    static void PutAddress(std::string &data, const boost::asio::ip::address &addr) {
+        std::array<unsigned char, 16> bytes{};
+        if (addr.is_v4()) {
+            auto v4 = addr.to_v4().to_bytes();
+            std::copy(v4.begin(), v4.end(), bytes.begin());
+        } else {
+            bytes = addr.to_v6().to_bytes();
+        }
+        data.push_back(addr.is_v4() ? 4 : 6);
+        data.append(reinterpret_cast<const char *>(bytes.data()), bytes.size());
+    }
+
+    static boost::asio::ip::address GetAddress(const std::string &data, size_t &pos) {
+        auto family = data[pos++];
+        std::array<unsigned char, 16> bytes;
+        std::copy(data.begin() + pos, data.begin() + pos + 16, bytes.begin());
+        pos += 16;
+        if (family == 4) {
+            return boost::asio::ip::address_v4{{{bytes[0], bytes[1], bytes[2], bytes[3]}}};
+        }
+        return boost::asio::ip::address_v6{bytes};
+    }
+
+    void Store(Key key, address_list addresses, boost::system::error_code ec, std::chrono::seconds ttl) {
+        auto expiry = clock_type::now() + ttl;
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto itr = index_.find(key);
+        if (itr != index_.end()) {
+            itr->second->addresses = std::move(addresses);
+            itr->second->error = ec;
+            itr->second->expiry = expiry;
+            itr->second->ttl = ttl;
+            itr->second->hits = 0;
+            itr->second->refreshing = false;
+            entries_.splice(entries_.begin(), entries_, itr->second);
+            return;
+        }
+        while (index_.size() >= options_.max_entries) {
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+        }
+        entries_.push_front(Entry{std::move(key), std::move(addresses), ec, expiry, ttl, 0, false});
+        index_.emplace(entries_.front().key, entries_.begin());
+    }
+
+    Options options_;
+    mutable std::mutex mutex_;
+    entry_list entries_; /* most recently used first */
+    std::unordered_map<Key, entry_list::iterator, KeyHash> index_;
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> stale_hits_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_CACHE_HXX__
@@ -13,42 +13,70 @@
 
 #include <memory>
 #include <map>
+#include <deque>
+#include <algorithm>
+#include <unordered_map>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iterator>
 #include <boost/asio.hpp>
 #include <boost/variant.hpp>
+#include <boost/container/small_vector.hpp>
 #include <ares.h>
 
 #include "error.hxx"
+#include "arena.hxx"
+#include "cache.hxx"
+#include "hosts.hxx"
+#include "stats.hxx"
+#include "trace.hxx"
+#include "health.hxx"
+#include "servers.hxx"
 #include "resolve_mode.hxx"
+#include "datagram_batch.hxx"
 
 namespace cares {
 namespace detail {
 
-inline std::shared_ptr<struct ares_socket_functions> GetSocketFunctions();
-inline char *GetAresLookups();
+inline char *GetAresLookups(bool files);
 
-inline ares_socket_t OpenSocket(int family, int type, int protocol, void *arg);
-inline int CloseSocket(ares_socket_t fd, void *arg);
-inline int ConnectSocket(ares_socket_t fd, const struct sockaddr *addr, ares_socklen_t len, void *arg);
-inline ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags, struct sockaddr *addr, ares_socklen_t *addr_len, void *arg);
-inline ares_ssize_t SendSocket(ares_socket_t fd, const struct iovec *data, int len, void *arg);
+/* arg is the Channel that owns the sockets */
+template<class Channel> std::shared_ptr<struct ares_socket_functions> GetSocketFunctions();
 
-inline void SocketStateCb(void *arg, ares_socket_t fd, int readable, int writeable);
+template<class Channel> ares_socket_t OpenSocket(int family, int type, int protocol, void *arg);
+template<class Channel> int CloseSocket(ares_socket_t fd, void *arg);
+template<class Channel> int ConnectSocket(ares_socket_t fd, const struct sockaddr *addr, ares_socklen_t len, void *arg);
+template<class Channel> ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags, struct sockaddr *addr, ares_socklen_t *addr_len, void *arg);
+template<class Channel> ares_ssize_t SendSocket(ares_socket_t fd, const struct iovec *data, int len, void *arg);
 
-class Channel : public std::enable_shared_from_this<Channel> {
+template<class Channel> void SocketStateCb(void *arg, ares_socket_t fd, int readable, int writeable);
+
+/*
+ * Trace is the tracing policy, see NoTrace. With enabled false every hook
+ * is a constant-false branch and compiles away.
+ */
+template<class Trace = NoTrace>
+class BasicChannel : public std::enable_shared_from_this<BasicChannel<Trace>> {
 public:
     using resolve_mode = ::cares::detail::resolve_mode;
+    using clock_type = std::chrono::steady_clock;
+    using trace_type = Trace;
 
 private:
     struct Socket : public std::enable_shared_from_this<Socket> {
         using tcp_type = boost::asio::ip::tcp::socket;
         using udp_type = boost::asio::ip::udp::socket;
+        using strand_type = boost::asio::io_context::strand;
 
-        Socket(tcp_type tcp)
-            : socket_(std::move(tcp)), is_tcp_(true) {
+        Socket(tcp_type tcp, strand_type &strand, std::shared_ptr<RecyclingArena> arena)
+            : socket_(std::move(tcp)), strand_(strand), arena_(std::move(arena)), is_tcp_(true) {
         }
 
-        Socket(udp_type udp)
-            : socket_(std::move(udp)), is_tcp_(false) {
+        Socket(udp_type udp, strand_type &strand, std::shared_ptr<RecyclingArena> arena)
+            : socket_(std::move(udp)), strand_(strand), arena_(std::move(arena)), is_tcp_(false) {
         }
 
         Socket(Socket &&) = default;
@@ -90,7 +118,7 @@ private:
 
         template<class Handler>
         void AsyncWaitRead(Handler &&cb) {
-            auto self{shared_from_this()};
+            auto self{this->shared_from_this()};
             auto handler = \
                 [this, self, cb=std::move(cb)](boost::system::error_code ec) {
                     cb();
@@ -99,15 +127,15 @@ private:
                     }
                 };
             if (IsTcp()) {
-                GetTcp().async_wait(tcp_type::wait_read, std::move(handler));
+                GetTcp().async_wait(tcp_type::wait_read, boost::asio::bind_executor(strand_, BindArena(arena_, std::move(handler))));
             } else {
-                GetUdp().async_wait(udp_type::wait_read, std::move(handler));
+                GetUdp().async_wait(udp_type::wait_read, boost::asio::bind_executor(strand_, BindArena(arena_, std::move(handler))));
             }
         }
 
         template<class Handler>
         void AsyncWaitWrite(Handler &&cb) {
-            auto self{shared_from_this()};
+            auto self{this->shared_from_this()};
             auto handler = \
                 [this, self, cb=std::move(cb)](boost::system::error_code ec) {
                     cb();
@@ -116,34 +144,199 @@ private:
                     }
                 };
             if (IsTcp()) {
-                GetTcp().async_wait(tcp_type::wait_write, std::move(handler));
+                GetTcp().async_wait(tcp_type::wait_write, boost::asio::bind_executor(strand_, BindArena(arena_, std::move(handler))));
             } else {
-                GetUdp().async_wait(udp_type::wait_write, std::move(handler));
+                GetUdp().async_wait(udp_type::wait_write, boost::asio::bind_executor(strand_, BindArena(arena_, std::move(handler))));
             }
         }
 
         boost::variant<udp_type, tcp_type> socket_;
+        strand_type &strand_; /* wait handlers touch the channel, keep them on its strand */
+        std::shared_ptr<RecyclingArena> arena_;
         bool is_tcp_;
+        boost::asio::ip::tcp::endpoint peer_; /* remembered at connect, saves a getpeername per tcp read */
+        ChannelStats::Server *server_ = nullptr; /* udp only, set at connect */
+
+        /*
+         * Unanswered sends by dns message id, for rtt samples. On a collision
+         * the older send keeps its slot, it is the one more likely to get an
+         * answer; slots unanswered for 10s are up for grabs again. A resend
+         * of the same id takes no sample (Karn), the answer may be to either.
+         */
+        struct SentQuery {
+            uint16_t id;
+            clock_type::time_point at;
+            bool resent;
+            bool expired;  /* already counted as a failure */
+        };
+        std::array<SentQuery, 128> sent_{};
+
+        void NoteSend(const struct iovec *data, int len) {
+            if (!server_) {
+                return;
+            }
+            server_->sent.fetch_add(1, std::memory_order_relaxed);
+            if (len > 0 && data[0].iov_len >= 2) {
+                auto id = MessageId(data[0].iov_base);
+                auto now = clock_type::now();
+                auto &slot = sent_[id % sent_.size()];
+                bool busy = (slot.at != clock_type::time_point{} && now - slot.at <= std::chrono::seconds{10});
+                if (!busy) {
+                    slot = SentQuery{id, now, false, false};
+                } else if (slot.id == id) {
+                    slot = SentQuery{id, now, true, false};
+                }
+            }
+        }
+
+        /* true if the answer matched a send, rtt is negative when that was a resend */
+        bool NoteAnswer(const void *data, ares_ssize_t length, clock_type::duration &rtt) {
+            if (!server_) {
+                return false;
+            }
+            server_->received.fetch_add(1, std::memory_order_relaxed);
+            if (length < 2) {
+                return false;
+            }
+            auto id = MessageId(data);
+            auto &query = sent_[id % sent_.size()];
+            if (query.id != id || query.at == clock_type::time_point{}) {
+                return false;
+            }
+            rtt = clock_type::duration{-1};
+            if (!query.resent) {
+                rtt = clock_type::now() - query.at;
+                server_->rtt.Record(rtt);
+            }
+            query.at = clock_type::time_point{};
+            return true;
+        }
+
+        /* how many sends went unanswered for longer than timeout, each is counted once */
+        uint32_t TakeExpired(clock_type::time_point now, clock_type::duration timeout) {
+            uint32_t expired = 0;
+            if (!server_) {
+                return expired;
+            }
+            for (auto &slot : sent_) {
+                if (slot.at != clock_type::time_point{} && !slot.expired && now - slot.at > timeout) {
+                    slot.expired = true;
+                    ++expired;
+                }
+            }
+            return expired;
+        }
+
+        static uint16_t MessageId(const void *message) {
+            auto *bytes = static_cast<const unsigned char *>(message);
+            return static_cast<uint16_t>((bytes[0] << 8) | bytes[1]);
+        }
+#if defined(__linux__)
+        std::unique_ptr<DatagramBatch> batch_; /* udp only, created on first batched use */
+
+        DatagramBatch &Batch() {
+            if (!batch_) {
+                batch_.reset(new DatagramBatch{});
+            }
+            return *batch_;
+        }
+#endif
+    };
+
+    /*
+     * fd -> Socket with O(1) lookups. Posix descriptors are small and dense, so
+     * they index a flat table directly; Windows SOCKETs are opaque handles.
+     * Find() hands out a borrowed pointer, only pending waits hold references.
+     */
+    class SocketTable {
+    public:
+        void Insert(ares_socket_t fd, std::shared_ptr<Socket> socket) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+            table_[fd] = std::move(socket);
+#else
+            if (static_cast<size_t>(fd) >= table_.size()) {
+                table_.resize(static_cast<size_t>(fd) + 1);
+            }
+            table_[fd] = std::move(socket);
+#endif
+            ++size_;
+        }
+
+        Socket *Find(ares_socket_t fd) const {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+            auto itr = table_.find(fd);
+            return itr == table_.end() ? nullptr : itr->second.get();
+#else
+            return static_cast<size_t>(fd) < table_.size() ? table_[fd].get() : nullptr;
+#endif
+        }
+
+        void Erase(ares_socket_t fd) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+            size_ -= table_.erase(fd);
+#else
+            if (static_cast<size_t>(fd) < table_.size() && table_[fd]) {
+                table_[fd].reset();
+                --size_;
+            }
+#endif
+        }
+
+        size_t Size() const {
+            return size_;
+        }
+
+        template<class Function>
+        void ForEach(Function &&function) const {
+            for (auto &entry : table_) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+                function(*entry.second);
+#else
+                if (entry) {
+                    function(*entry);
+                }
+#endif
+            }
+        }
+
+    private:
+#if defined(_WIN32) && !defined(__CYGWIN__)
+        std::unordered_map<ares_socket_t, std::shared_ptr<Socket>> table_;
+#else
+        std::vector<std::shared_ptr<Socket>> table_;
+#endif
+        size_t size_ = 0;
     };
 public:
-    using AsyncCallback = std::function<void(boost::system::error_code, struct hostent *)>;
     using native_handle_type = ares_channel;
+    using allocator_type = ArenaAllocator<void>;
+
+    BasicChannel(const BasicChannel &) = delete;
+    explicit BasicChannel(boost::asio::io_context &ios, boost::posix_time::time_duration timeout = boost::posix_time::millisec{3000})
+        : BasicChannel(ios, ios, timeout) {
+    }
 
-    Channel(const Channel &) = delete;
-    explicit Channel(boost::asio::io_context &ios, boost::posix_time::time_duration timeout = boost::posix_time::millisec{3000})
-        : context_(ios), strand_(context_),
-          timer_(context_), timer_period_(timeout / 2),
-          functions_(GetSocketFunctions()), request_count_(0),
-          resolve_mode_(both) {
+    /* sockets and timers live on ios, completion handlers are posted to completion */
+    BasicChannel(boost::asio::io_context &ios, boost::asio::io_context &completion, boost::posix_time::time_duration timeout = boost::posix_time::millisec{3000})
+        : BasicChannel(ios, completion, std::make_shared<RecyclingArena>(), timeout) {
+    }
+
+    /* channels of a pool share one arena */
+    BasicChannel(boost::asio::io_context &ios, boost::asio::io_context &completion, std::shared_ptr<RecyclingArena> arena,
+            boost::posix_time::time_duration timeout = boost::posix_time::millisec{3000})
+        : context_(ios), completion_context_(completion), strand_(context_),
+          timer_(context_), timer_expiry_(clock_type::time_point::max()),
+          timeout_(std::chrono::milliseconds{timeout.total_milliseconds()}), try_timeout_(timeout_), tries_(1),
+          arena_(std::move(arena)), functions_(GetSocketFunctions<BasicChannel>()),
+          pending_(allocator_type{arena_}), waiting_(typename WaitingQueue::allocator_type{arena_}), request_count_(0), record_requests_(0),
+          resolve_mode_(both), resolution_delay_(50),
+          coalesce_readiness_(false), drain_pending_(false),
+          batch_datagrams_(false), flush_pending_(false), adaptive_servers_(false), adaptive_timeout_(false),
+          max_in_flight_(0), max_waiting_(0), admitting_(false),
+          config_timer_(context_), config_watch_(0), config_interval_(0), explicit_servers_(false), servers_pending_(false), ares_reads_hosts_(true) {
 
         struct ares_options option;
-        memset(&option, 0, sizeof option);
-        option.sock_state_cb = SocketStateCb;
-        option.sock_state_cb_data = this;
-        option.timeout = timeout.total_milliseconds();
-        option.tries = 1;
-        option.lookups = GetAresLookups();
-        int mask = ARES_OPT_NOROTATE | ARES_OPT_TIMEOUTMS | ARES_OPT_SOCK_STATE_CB | ARES_OPT_TRIES | ARES_OPT_LOOKUPS;
+        int mask = InitOptions(option, timeout_, 1);
 
         int ret = ::ares_init_options(&channel_, &option, mask);
         if (ret != ARES_SUCCESS) {
@@ -156,57 +349,217 @@ public:
         }
 
         ::ares_set_socket_functions(channel_, functions_.get(), this);
+        ReadServers();
     }
 
-    ~Channel() {
-        Cancel();
+    ~BasicChannel() {
+        /* every pending query and probe holds a reference, nothing can be in flight here */
+        for (auto &generation : retired_) {
+            ::ares_destroy(generation.channel);
+        }
         ::ares_destroy(channel_);
     }
 
     template<class Results, class Handler>
     void AsyncGetHostByName(const std::string &domain, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler) {
-        auto self{shared_from_this()};
+        AsyncGetHostByName(domain, GetResolveMode(), result, handler, std::false_type{});
+    }
+
+    /* Mode known at compile time: a single query mode goes without a counter and a merge */
+    template<class Results, class Handler, resolve_mode Mode>
+    void AsyncGetHostByName(const std::string &domain, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler, FixedMode<Mode>) {
+        AsyncGetHostByName(domain, Mode, result, handler, std::integral_constant<bool, is_single_query_mode(Mode)>{});
+    }
+
+    /*
+     * RFC 8305 style delivery: every family is handed over as soon as it is
+     * known, (*handler)(ec, results, more) with more set while another
+     * callback will follow. An early answer of the less preferred family
+     * waits up to the resolution delay for the preferred one.
+     */
+    template<class Results, class Handler>
+    void AsyncGetHostByNameStream(const std::string &domain, std::shared_ptr<Results> prototype, std::shared_ptr<Handler> handler) {
+        auto self{this->shared_from_this()};
         auto mode = GetResolveMode();
-        auto remain_requests = std::make_shared<uint32_t>(1);
+        auto delay = GetResolutionDelay();
 
-        if (mode != ipv6_only && mode != ipv4_only) {
-            ++*remain_requests;
-        }
+        boost::asio::dispatch(
+            strand_,
+            BindArena(arena_, [this, self, domain{MakeName(domain)}, mode, delay, prototype, handler]() {
+                auto stream = std::allocate_shared<StreamRequest<Results, Handler>>(allocator_type{arena_}, context_, completion_context_, *prototype);
+                stream->handler = handler;
+                stream->delay = delay;
+                auto families = FamiliesOf(mode);
+                stream->remain = static_cast<uint32_t>(families.size());
+                stream->preferred = AF_UNSPEC;
+                if (mode == ipv4_first) {
+                    stream->preferred = AF_INET;
+                } else if (mode == ipv6_first) {
+                    stream->preferred = AF_INET6;
+                }
 
-        if (mode != ipv6_only) {
-            AsyncGetHostByNameInternal(
-                domain, AF_INET,
-                std::bind(
-                    &Channel::ResultHandler<Results, Handler>, self,
-                    std::placeholders::_1, std::placeholders::_2,
-                    result, handler, remain_requests
-                )
-            );
-        }
+                for (auto family : families) {
+                    AsyncGetHostByNameInternal(
+                        domain, family,
+                        std::bind(
+                            &BasicChannel::StreamResultHandler<Results, Handler>, self,
+                            std::placeholders::_1, std::placeholders::_2,
+                            family, mode, stream
+                        )
+                    );
+                }
+            })
+        );
+    }
 
-        if (mode != ipv4_only) {
-            AsyncGetHostByNameInternal(
-                domain, AF_INET6,
-                std::bind(
-                    &Channel::ResultHandler<Results, Handler>, self,
-                    std::placeholders::_1, std::placeholders::_2,
-                    result, handler, remain_requests
-                )
-            );
-        }
+    /*
+     * One query for records of type, on the same sockets and timer as the
+     * address lookups. Results::Assign parses the answer before
+     * (*handler)(ec, results) is posted.
+     */
+    template<class Results, class Handler>
+    void AsyncQuery(const std::string &name, int type, query_scope scope, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler) {
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
+            strand_,
+            BindArena(arena_, [this, self, name{MakeName(name)}, type, scope, result, handler]() {
+                auto *query = new RecordQuery<Results, Handler>{self, channel_, clock_type::now(), name, result, handler};
+                ++record_requests_;
+                ++request_count_;
+                stats_.queries.fetch_add(1, std::memory_order_relaxed);
+                stats_.in_flight.store(request_count_, std::memory_order_relaxed);
+                TraceStep(trace_stage::submit, name.c_str(), AF_UNSPEC, ARES_SOCKET_BAD);
+                if (scope == query_scope::search) {
+                    ::ares_search(channel_, name.c_str(), 1 /* C_IN */, type, &BasicChannel::RecordCallback<Results, Handler>, query);
+                } else {
+                    ::ares_query(channel_, name.c_str(), 1 /* C_IN */, type, &BasicChannel::RecordCallback<Results, Handler>, query);
+                }
+                if (request_count_ != 0) {
+                    TimerStart();
+                }
+            })
+        );
+    }
+
+    /*
+     * names are (table index, name) pairs, each table entry has error and results.
+     * The handler gets the shared table back, (*handler)(ec, table).
+     */
+    template<class Table, class Handler>
+    void AsyncGetHostByNameBatch(std::vector<std::pair<size_t, std::string>> names, std::shared_ptr<Table> table, std::shared_ptr<Handler> handler) {
+        auto self{this->shared_from_this()};
+        auto mode = GetResolveMode();
+
+        boost::asio::dispatch(
+            strand_,
+            BindArena(arena_, [this, self, names{std::move(names)}, mode, table, handler]() {
+                auto families = FamiliesOf(mode);
+                auto batch = std::allocate_shared<BatchRequest<Table, Handler>>(allocator_type{arena_});
+                batch->table = table;
+                batch->handler = handler;
+                batch->outstanding = names.size();
+                batch->resolved = false;
+                batch->slots.reserve(names.size());
+                for (auto &name : names) {
+                    batch->slots.emplace_back(name.first, MergeState{static_cast<uint32_t>(families.size()), {}});
+                }
+
+                for (size_t slot = 0; slot < names.size(); ++slot) {
+                    auto name = MakeName(names[slot].second);
+                    for (auto family : families) {
+                        AsyncGetHostByNameInternal(
+                            name, family,
+                            std::bind(
+                                &BasicChannel::BatchResultHandler<Table, Handler>, self,
+                                std::placeholders::_1, std::placeholders::_2,
+                                mode, batch, slot
+                            )
+                        );
+                    }
+                }
+            })
+        );
     }
 
     void Cancel() {
-        ::ares_cancel(channel_);
-        TimerStop();
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
+            strand_,
+            [this, self]() {
+                /* queued lookups first, cancelled answers would hand their slots on */
+                FailWaiting(boost::system::error_code{error::operation_cancelled, error::get_category()});
+                for (auto channel : Generations()) {
+                    ::ares_cancel(channel);
+                }
+                TimerStop();
+            }
+        );
     }
 
     void SetServerPortsCsv(const std::string &servers, boost::system::error_code &ec) {
         ec.clear();
-        int ret = ::ares_set_servers_ports_csv(channel_, servers.c_str());
-        if (ret != ARES_SUCCESS) {
-            ec.assign(ret, error::get_category());
+        ServerList list;
+        if (!ParseServersCsv(servers, list)) {
+            ec.assign(error::bad_string, error::get_category());
+            return;
         }
+        SetServers(std::move(list));
+    }
+
+    /* kept across config reloads, resolv.conf no longer decides the servers; empty clears them */
+    void SetServers(ServerList servers) {
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
+            strand_,
+            [this, self, servers{std::move(servers)}]() mutable {
+                explicit_servers_ = true;
+                servers_pending_ = true;
+                pending_servers_ = std::move(servers);
+                ApplyServers();
+            }
+        );
+    }
+
+    /* re-reads the system config now, lookups in flight finish on the old one */
+    void ReloadConfig() {
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
+            strand_,
+            [this, self]() {
+                Reload();
+            }
+        );
+    }
+
+    /*
+     * Looks at path every interval and reloads once its contents change;
+     * reloads then read the config from path. Zero stops watching.
+     */
+    void WatchConfig(std::chrono::milliseconds interval, std::string path) {
+        config_interval_.store(interval.count());
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
+            strand_,
+            [this, self, interval, path{std::move(path)}]() mutable {
+                ++config_watch_;
+                config_timer_.cancel();
+                if (interval.count() == 0) {
+                    return;
+                }
+                /* another file than the channel was made from is read right away */
+                bool moved = (path != config_path_);
+                config_path_ = std::move(path);
+                config_text_ = ReadConfigText(config_path_);
+                if (moved) {
+                    Reload();
+                }
+                ArmConfigWatch(interval);
+            }
+        );
+    }
+
+    std::chrono::milliseconds GetConfigWatch() const {
+        return std::chrono::milliseconds{config_interval_.load()};
     }
 
     void SetResolveMode(resolve_mode mode, boost::system::error_code &ec) {
@@ -215,57 +568,994 @@ public:
             ec.assign(error::not_implemented, error::get_category());
             return;
         }
-        resolve_mode_ = mode;
+        resolve_mode_.store(mode);
     }
 
     resolve_mode GetResolveMode() const {
-        return resolve_mode_;
+        return resolve_mode_.load();
     }
 
+    void SetResolutionDelay(std::chrono::milliseconds delay) {
+        resolution_delay_.store(delay.count());
+    }
+
+    std::chrono::milliseconds GetResolutionDelay() const {
+        return std::chrono::milliseconds{resolution_delay_.load()};
+    }
+
+    /* drain all sockets that turned ready in one strand turn with a single ares_process */
+    void SetCoalesceReadiness(bool enable) {
+        coalesce_readiness_.store(enable);
+    }
+
+    bool GetCoalesceReadiness() const {
+        return coalesce_readiness_.load();
+    }
+
+    /*
+     * Linux only, ignored elsewhere: udp answers are read with recvmmsg and
+     * queries written in one turn leave with a single sendmmsg.
+     */
+    void SetBatchDatagrams(bool enable) {
+        batch_datagrams_.store(enable);
+    }
+
+    bool GetBatchDatagrams() const {
+        return batch_datagrams_.load();
+    }
+
+    /* with a table attached c-ares stops reading the file, which takes a new generation */
+    void SetHosts(std::shared_ptr<HostsTable> hosts) {
+        std::atomic_store(&hosts_, std::move(hosts));
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(strand_, [this, self]() {
+            bool files = !GetHosts();
+            if (files == ares_reads_hosts_) {
+                return;
+            }
+            ares_reads_hosts_ = files;
+            native_handle_type fresh;
+            if (NewGeneration(servers_, try_timeout_, tries_, fresh)) {
+                Retire(fresh);
+            }
+        });
+    }
+
+    std::shared_ptr<HostsTable> GetHosts() const {
+        return std::atomic_load(&hosts_);
+    }
+
+    void SetCache(std::shared_ptr<ResolveCache> cache) {
+        std::atomic_store(&cache_, std::move(cache));
+    }
+
+    std::shared_ptr<ResolveCache> GetCache() const {
+        return std::atomic_load(&cache_);
+    }
+
+    /* the channel new queries go to, replaced when adaptive servers reorder */
     native_handle_type GetNativeHandle() {
         return channel_;
     }
 
+    /*
+     * Tries the fastest healthy server first instead of the configured order,
+     * see ServerHealth. Off by default, the configured order may be a policy.
+     */
+    void SetAdaptiveServers(bool enable) {
+        adaptive_servers_.store(enable);
+    }
+
+    bool GetAdaptiveServers() const {
+        return adaptive_servers_.load();
+    }
+
+    /*
+     * Retries after the first server's rto instead of waiting out the whole
+     * timeout once, the timeout stays the budget for all tries together.
+     */
+    void SetAdaptiveTimeout(bool enable) {
+        adaptive_timeout_.store(enable);
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(strand_, [this, self]() {
+            next_rebalance_ = clock_type::time_point{};
+            Rebalance();
+        });
+    }
+
+    bool GetAdaptiveTimeout() const {
+        return adaptive_timeout_.load();
+    }
+
+    /*
+     * Admission control, 0 means no limit: at most max_in_flight ares queries
+     * (one per name and family) at once, further ones wait in FIFO order for
+     * a slot, and once max_waiting of them wait the next fails with
+     * error::overloaded. Lookups joining a query already in flight or
+     * waiting take no slot. max_waiting 0 rejects right away.
+     */
+    void SetMaxInFlight(size_t limit) {
+        max_in_flight_.store(limit);
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(strand_, [this, self]() {
+            Admit();
+        });
+    }
+
+    size_t GetMaxInFlight() const {
+        return max_in_flight_.load();
+    }
+
+    void SetMaxWaiting(size_t limit) {
+        max_waiting_.store(limit);
+    }
+
+    size_t GetMaxWaiting() const {
+        return max_waiting_.load();
+    }
+
+    /* counters and latency histograms, cheap enough to be always on */
+    StatsSnapshot GetStats() const {
+        return stats_.Snapshot();
+    }
+
+    /* where per-request state comes from when the handler brings no allocator */
+    allocator_type GetAllocator() const {
+        return allocator_type{arena_};
+    }
+
 private:
-    struct ChannelComplete {
-        std::shared_ptr<Channel> channel;
-        AsyncCallback callback;
+    using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+    using QueryKey = std::pair<ArenaString, int>;
+
+    /*
+     * Type-erased (ec, entries) callback like std::function, but the bound
+     * state lives in an arena block. Move only.
+     */
+    class AsyncCallback {
+    public:
+        template<class Function>
+        AsyncCallback(RecyclingArena &arena, Function &&function) {
+            using holder_type = Holder<typename std::decay<Function>::type>;
+            holder_ = new (arena.Allocate(sizeof(holder_type))) holder_type{arena, std::forward<Function>(function)};
+        }
+
+        AsyncCallback(AsyncCallback &&other) noexcept
+            : holder_(other.holder_) {
+            other.holder_ = nullptr;
+        }
+
+        AsyncCallback &operator=(AsyncCallback &&other) noexcept {
+            std::swap(holder_, other.holder_);
+            return *this;
+        }
+
+        ~AsyncCallback() {
+            if (holder_) {
+                holder_->Destroy();
+            }
+        }
+
+        void operator()(boost::system::error_code ec, struct ares_addrinfo *entries) {
+            holder_->Invoke(ec, entries);
+        }
+
+    private:
+        struct HolderBase {
+            virtual void Invoke(boost::system::error_code ec, struct ares_addrinfo *entries) = 0;
+            virtual void Destroy() = 0;
+
+        protected:
+            ~HolderBase() = default;
+        };
+
+        template<class Function>
+        struct Holder final : HolderBase {
+            Holder(RecyclingArena &arena, Function function)
+                : arena(arena), function(std::move(function)) {
+            }
+
+            void Invoke(boost::system::error_code ec, struct ares_addrinfo *entries) override {
+                function(ec, entries);
+            }
+
+            void Destroy() override {
+                auto &owner = arena;
+                this->~Holder();
+                owner.Deallocate(this, sizeof(Holder));
+            }
+
+            RecyclingArena &arena;
+            Function function;
+        };
+
+        HolderBase *holder_;
     };
 
-    template<class Callback>
-    void AsyncGetHostByNameInternal(const std::string &domain, int family, Callback &&cb) {
-        auto comp = std::make_unique<ChannelComplete>();
-        auto self{shared_from_this()};
-        comp->channel = self;
-        comp->callback = std::move(cb);
-        ::ares_gethostbyname(channel_, domain.c_str(), family, &Channel::HostCallback, comp.release());
-        boost::asio::post(
+    /* one per query on the wire, c-ares carries a pointer to it */
+    struct PendingQuery {
+        using callback_list = boost::container::small_vector<AsyncCallback, 2, ArenaAllocator<AsyncCallback>>;
+
+        explicit PendingQuery(const allocator_type &allocator)
+            : callbacks(typename callback_list::allocator_type{ArenaAllocator<AsyncCallback>{allocator}}) {
+        }
+
+        callback_list callbacks;
+        std::shared_ptr<BasicChannel> channel; /* alive until the answer is in */
+        native_handle_type owner = nullptr;    /* the ares channel it was submitted to */
+        clock_type::time_point started;
+        bool waiting = false;                  /* in waiting_, not submitted yet */
+    };
+
+    /* an ares channel that lost its place to a reordered one, or a probe */
+    struct Generation {
+        native_handle_type channel;
+        int64_t requests;
+        clock_type::duration try_timeout; /* what it waits per try, its retries are no sooner */
+    };
+
+    struct ProbeQuery {
+        std::shared_ptr<BasicChannel> channel;
+        native_handle_type owner;
+        ServerAddress server;
+        clock_type::time_point started;
+    };
+
+    /* an AsyncQuery on the wire, not coalesced and not subject to admission */
+    template<class Results, class Handler>
+    struct RecordQuery {
+        std::shared_ptr<BasicChannel> channel;
+        native_handle_type owner;
+        clock_type::time_point started;
+        ArenaString name;
+        std::shared_ptr<Results> result;
+        std::shared_ptr<Handler> handler;
+    };
+
+    using PendingMap = std::map<QueryKey, PendingQuery, std::less<QueryKey>, ArenaAllocator<std::pair<const QueryKey, PendingQuery>>>;
+    using WaitingQueue = std::deque<typename PendingMap::iterator, ArenaAllocator<typename PendingMap::iterator>>;
+
+    /* one query per family, ResultHandler merges them as mode says */
+    template<class Results, class Handler>
+    void AsyncGetHostByName(const std::string &domain, resolve_mode mode, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler, std::false_type) {
+        auto self{this->shared_from_this()};
+        auto started = clock_type::now();
+
+        /* the ares_channel is only ever touched from strand_ */
+        boost::asio::dispatch(
             strand_,
-            [this, self]() {
-                if (request_count_ == 0) {
-                    TimerStart();
+            BindArena(arena_, [this, self, domain{MakeName(domain)}, mode, started, result, handler]() {
+                auto families = FamiliesOf(mode);
+                auto remain_requests = std::allocate_shared<MergeState>(allocator_type{arena_}, MergeState{static_cast<uint32_t>(families.size()), {}});
+
+                for (auto family : families) {
+                    AsyncGetHostByNameInternal(
+                        domain, family,
+                        std::bind(
+                            &BasicChannel::ResultHandler<Results, Handler>, self,
+                            std::placeholders::_1, std::placeholders::_2,
+                            mode, started, result, handler, remain_requests
+                        )
+                    );
                 }
-                ++request_count_;
+            })
+        );
+    }
+
+    template<class Results, class Handler>
+    void AsyncGetHostByName(const std::string &domain, resolve_mode mode, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler, std::true_type) {
+        auto self{this->shared_from_this()};
+        auto started = clock_type::now();
+
+        boost::asio::dispatch(
+            strand_,
+            BindArena(arena_, [this, self, domain{MakeName(domain)}, mode, started, result, handler]() {
+                AsyncGetHostByNameInternal(
+                    domain, SingleFamilyOf(mode),
+                    [this, self, mode, started, result, handler](boost::system::error_code ec, struct ares_addrinfo *entries) {
+                        if (!ec) {
+                            result->Append(entries);
+                        }
+                        stats_.resolve_latency[mode].Record(clock_type::now() - started);
+                        boost::asio::post(
+                            completion_context_,
+                            BindArena(arena_, [handler, ec, result]() {
+                                (*handler)(ec, std::move(*result));
+                            })
+                        );
+                    }
+                );
+            })
+        );
+    }
+
+    /* one ares query per entry; rfc6724 asks for both in one and lets c-ares sort */
+    static boost::container::small_vector<int, 2> FamiliesOf(resolve_mode mode) {
+        switch (mode) {
+        case ipv4_only:
+            return {AF_INET};
+        case ipv6_only:
+            return {AF_INET6};
+        case rfc6724:
+            return {AF_UNSPEC};
+        default:
+            return {AF_INET, AF_INET6};
+        }
+    }
+
+    static constexpr int SingleFamilyOf(resolve_mode mode) {
+        return (mode == ipv4_only) ? AF_INET : (mode == ipv6_only) ? AF_INET6 : AF_UNSPEC;
+    }
+
+    ArenaString MakeName(const std::string &name) const {
+        return ArenaString{name.data(), name.size(), ArenaAllocator<char>{arena_}};
+    }
+
+    template<class Results, class Callback>
+    struct StreamRequest {
+        StreamRequest(boost::asio::io_context &ios, boost::asio::io_context &completion, const Results &prototype)
+            : timer(ios), completion_strand(completion), prototype(prototype), held(prototype) {
+        }
+
+        std::shared_ptr<Callback> handler;
+        boost::asio::steady_timer timer;
+        /* deliveries are ordered even on a multi-threaded completion context */
+        boost::asio::io_context::strand completion_strand;
+        std::chrono::milliseconds delay;
+        Results prototype; /* empty, only carries the port */
+        Results held;      /* less preferred answer waiting for the delay */
+        int preferred;
+        uint32_t remain;
+        bool holding = false;
+        bool delivered = false;
+        bool finished = false;
+        boost::system::error_code error;
+    };
+
+    /* what the families of one lookup have answered so far */
+    struct MergeState {
+        uint32_t remain;
+        boost::system::error_code error; /* reported when no family has addresses */
+    };
+
+    /* shared by every lookup of one batch, slots map to (table index, merge state) */
+    template<class Table, class Callback>
+    struct BatchRequest {
+        std::shared_ptr<Table> table;
+        std::shared_ptr<Callback> handler;
+        std::vector<std::pair<size_t, MergeState>> slots;
+        size_t outstanding;
+        bool resolved;
+        boost::system::error_code error;
+    };
+
+    template<class Callback>
+    void AsyncGetHostByNameInternal(const ArenaString &domain, int family, Callback &&cb) {
+        /* identical lookups already on the wire, or waiting for it, just wait for that answer */
+        QueryKey key{domain, family};
+        auto itr = pending_.find(key);
+        if (itr != pending_.end()) {
+            itr->second.callbacks.emplace_back(*arena_, std::forward<Callback>(cb));
+            stats_.coalesced.fetch_add(1, std::memory_order_relaxed);
+            TraceStep(trace_stage::join, domain.c_str(), family, ARES_SOCKET_BAD);
+            return;
+        }
+        bool full = !HasFreeSlot();
+        if (full && waiting_.size() >= max_waiting_.load(std::memory_order_relaxed)) {
+            boost::system::error_code ec{error::overloaded, error::get_category()};
+            stats_.rejected.fetch_add(1, std::memory_order_relaxed);
+            TraceStep(trace_stage::reject, domain.c_str(), family, ARES_SOCKET_BAD, ec);
+            cb(ec, nullptr);
+            return;
+        }
+        itr = pending_.emplace(
+            std::piecewise_construct,
+            std::forward_as_tuple(std::move(key)),
+            std::forward_as_tuple(GetAllocator())
+        ).first;
+        itr->second.callbacks.emplace_back(*arena_, std::forward<Callback>(cb));
+        itr->second.channel = this->shared_from_this();
+        if (full) {
+            itr->second.waiting = true;
+            waiting_.push_back(itr);
+            stats_.queued.fetch_add(1, std::memory_order_relaxed);
+            stats_.waiting.store(static_cast<int64_t>(waiting_.size()), std::memory_order_relaxed);
+            TraceStep(trace_stage::queue, domain.c_str(), family, ARES_SOCKET_BAD);
+            return;
+        }
+        Submit(itr);
+    }
+
+    void Submit(typename PendingMap::iterator itr) {
+        auto &domain = itr->first.first;
+        auto family = itr->first.second;
+        itr->second.owner = channel_;
+        itr->second.started = clock_type::now();
+
+        /* counted before submitting, the callback may run synchronously */
+        ++request_count_;
+        stats_.queries.fetch_add(1, std::memory_order_relaxed);
+        stats_.in_flight.store(request_count_, std::memory_order_relaxed);
+        TraceStep(trace_stage::submit, domain.c_str(), family, ARES_SOCKET_BAD);
+
+        /* ares_getaddrinfo keeps the record ttls that hostent drops */
+        struct ares_addrinfo_hints hints;
+        memset(&hints, 0, sizeof hints);
+        hints.ai_family = family;
+        hints.ai_flags = (family == AF_UNSPEC) ? 0 : ARES_AI_NOSORT;
+        ::ares_getaddrinfo(channel_, domain.c_str(), nullptr, &hints, &BasicChannel::HostCallback, &*itr);
+        if (request_count_ != 0) {
+            TimerStart();
+        }
+    }
+
+    /* waiting lookups are in pending_ too, so they can be joined */
+    bool HasFreeSlot() const {
+        auto limit = max_in_flight_.load(std::memory_order_relaxed);
+        return limit == 0 || pending_.size() - waiting_.size() < limit;
+    }
+
+    /* hands free slots to waiting lookups, submits that answer right away cannot recurse */
+    void Admit() {
+        if (admitting_) {
+            return;
+        }
+        admitting_ = true;
+        while (!waiting_.empty() && HasFreeSlot()) {
+            auto itr = waiting_.front();
+            waiting_.pop_front();
+            itr->second.waiting = false;
+            Submit(itr);
+        }
+        stats_.waiting.store(static_cast<int64_t>(waiting_.size()), std::memory_order_relaxed);
+        admitting_ = false;
+    }
+
+    void FailWaiting(boost::system::error_code ec) {
+        /* swapped, a moved-from queue would lose its arena */
+        WaitingQueue waiting{waiting_.get_allocator()};
+        waiting.swap(waiting_);
+        for (auto itr : waiting) {
+            auto callbacks{std::move(itr->second.callbacks)};
+            pending_.erase(itr);
+            for (auto &callback : callbacks) {
+                callback(ec, nullptr);
+            }
+        }
+        stats_.waiting.store(0, std::memory_order_relaxed);
+    }
+
+    /*
+     * An idle ares channel takes the servers as they are. ares refuses that
+     * under in-flight queries, then a new generation takes over and the old
+     * one drains; servers that could not go anywhere wait for the next try.
+     */
+    void ApplyServers() {
+        if (!servers_pending_) {
+            return;
+        }
+        std::vector<struct ares_addr_port_node> nodes;
+        int ret = ::ares_set_servers_ports(channel_, MakeServerNodes(pending_servers_, nodes));
+        if (ret != ARES_SUCCESS && !ReplaceServers(pending_servers_, try_timeout_, tries_)) {
+            return;
+        }
+        servers_ = std::move(pending_servers_);
+        pending_servers_.clear();
+        servers_pending_ = false;
+        health_.SetServers(servers_);
+    }
+
+    /* the options of every ares channel that is not a copy of channel_ */
+    int InitOptions(struct ares_options &option, clock_type::duration timeout, int tries) {
+        memset(&option, 0, sizeof option);
+        option.sock_state_cb = SocketStateCb<BasicChannel>;
+        option.sock_state_cb_data = this;
+        option.timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
+        option.tries = tries;
+        option.lookups = GetAresLookups(ares_reads_hosts_);
+        int mask = ARES_OPT_NOROTATE | ARES_OPT_TIMEOUTMS | ARES_OPT_SOCK_STATE_CB | ARES_OPT_TRIES | ARES_OPT_LOOKUPS;
+        if (!config_path_.empty()) {
+            option.resolvconf_path = const_cast<char *>(config_path_.c_str());
+            mask |= ARES_OPT_RESOLVCONF;
+        }
+        return mask;
+    }
+
+    /*
+     * A fresh ares channel from the system config, so search domains, ndots
+     * and the rest are current, swapped in like a new generation. Servers
+     * from SetServers stay, otherwise the config's replace them.
+     */
+    bool Reload() {
+        struct ares_options option;
+        int mask = InitOptions(option, try_timeout_, tries_);
+        native_handle_type fresh;
+        if (::ares_init_options(&fresh, &option, mask) != ARES_SUCCESS) {
+            return false;
+        }
+        ::ares_set_socket_functions(fresh, functions_.get(), this);
+
+        ServerList servers;
+        if (explicit_servers_) {
+            servers = servers_pending_ ? std::move(pending_servers_) : servers_;
+            pending_servers_.clear();
+            servers_pending_ = false;
+            std::vector<struct ares_addr_port_node> nodes;
+            if (::ares_set_servers_ports(fresh, MakeServerNodes(servers, nodes)) != ARES_SUCCESS) {
+                ::ares_destroy(fresh);
+                return false;
+            }
+        } else {
+            struct ares_addr_port_node *nodes = nullptr;
+            if (::ares_get_servers_ports(fresh, &nodes) == ARES_SUCCESS) {
+                servers = ReadServerNodes(nodes);
+                ::ares_free_data(nodes);
+            }
+        }
+        Retire(fresh);
+        servers_ = std::move(servers);
+        health_.SetServers(servers_);
+        stats_.reloads.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    static std::string ReadConfigText(const std::string &path) {
+        std::ifstream file{path, std::ios::binary};
+        return std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+    }
+
+    /* the timer outlives nothing: a destroyed channel just ends the watch */
+    void ArmConfigWatch(std::chrono::milliseconds interval) {
+        std::weak_ptr<BasicChannel> weak{this->shared_from_this()};
+        auto watch = config_watch_;
+        config_timer_.expires_after(interval);
+        config_timer_.async_wait([weak, watch, interval](boost::system::error_code ec) {
+            auto self = weak.lock();
+            if (ec || !self) {
+                return;
+            }
+            auto &strand = self->strand_;
+            boost::asio::dispatch(strand, [self{std::move(self)}, watch, interval]() {
+                if (watch != self->config_watch_) {
+                    return;
+                }
+                auto text = ReadConfigText(self->config_path_);
+                /* a failed reload is tried again on the next look */
+                if (text != self->config_text_ && self->Reload()) {
+                    self->config_text_ = std::move(text);
+                }
+                self->ArmConfigWatch(interval);
+            });
+        });
+    }
+
+    /* what the constructor's ares channel picked up from the system config */
+    void ReadServers() {
+        struct ares_addr_port_node *nodes = nullptr;
+        if (::ares_get_servers_ports(channel_, &nodes) != ARES_SUCCESS) {
+            return;
+        }
+        servers_ = ReadServerNodes(nodes);
+        ::ares_free_data(nodes);
+        health_.SetServers(servers_);
+    }
+
+    bool IsAdaptive() const {
+        return adaptive_servers_.load(std::memory_order_relaxed) || adaptive_timeout_.load(std::memory_order_relaxed);
+    }
+
+    /*
+     * Switches the server order or the retry schedule if health asks for it
+     * and sends due probes. Runs on the strand, never from inside an ares call.
+     */
+    void Rebalance() {
+        bool servers = adaptive_servers_.load(std::memory_order_relaxed);
+        bool timeouts = adaptive_timeout_.load(std::memory_order_relaxed);
+        /* switched off again, go back to the configured schedule once */
+        bool tuned = (tries_ != 1 || try_timeout_ != timeout_);
+        if ((!servers && !timeouts && !tuned) || servers_.empty() || servers_pending_) {
+            return;
+        }
+        auto now = clock_type::now();
+        if (now < next_rebalance_) {
+            return;
+        }
+        next_rebalance_ = now + std::chrono::milliseconds{100};
+
+        ServerList order;
+        bool reorder = false;
+        if (servers && servers_.size() > 1) {
+            for (auto &server : health_.TakeProbes(servers_)) {
+                StartProbe(server);
+            }
+            reorder = health_.Reorder(servers_, order);
+        }
+        if (!reorder) {
+            order = servers_;
+        }
+
+        auto try_timeout = timeout_;
+        int tries = 1;
+        if (timeouts) {
+            /* ares runs every try against each server in turn, so each gets its share */
+            health_.RetrySchedule(order.front(), timeout_ / static_cast<int>(order.size()), try_timeout, tries);
+            /* ares takes whole milliseconds */
+            auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(try_timeout);
+            try_timeout = (millis < try_timeout) ? millis + std::chrono::milliseconds{1} : millis;
+        }
+        /* a new ares channel per rtt wiggle would be a waste, only clear changes count */
+        bool retune = (tries != tries_ || try_timeout * 4 < try_timeout_ * 3 || try_timeout * 3 > try_timeout_ * 4);
+        retune = retune && (now >= next_retune_ || !timeouts);
+        if (reorder || retune) {
+            if (!retune) {
+                try_timeout = try_timeout_;
+                tries = tries_;
+            }
+            next_retune_ = now + std::chrono::seconds{1};
+            ReplaceServers(std::move(order), try_timeout, tries);
+        }
+    }
+
+    /*
+     * A copy of channel_ with other servers and retry schedule. Made from
+     * the saved options like ares_dup does, that one cannot change them.
+     */
+    bool NewGeneration(const ServerList &servers, clock_type::duration try_timeout, int tries, native_handle_type &fresh) {
+        struct ares_options options;
+        int mask;
+        if (::ares_save_options(channel_, &options, &mask) != ARES_SUCCESS) {
+            return false;
+        }
+        options.timeout = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(try_timeout).count());
+        options.tries = tries;
+        /* the saved copy is ares' to free, ours only stands in for init */
+        auto *saved_lookups = options.lookups;
+        options.lookups = GetAresLookups(ares_reads_hosts_);
+        mask = (mask & ~ARES_OPT_TIMEOUT) | ARES_OPT_TIMEOUTMS | ARES_OPT_TRIES | ARES_OPT_LOOKUPS;
+        int ret = ::ares_init_options(&fresh, &options, mask);
+        options.lookups = saved_lookups;
+        ::ares_destroy_options(&options);
+        if (ret != ARES_SUCCESS) {
+            return false;
+        }
+        ::ares_set_socket_functions(fresh, functions_.get(), this);
+        std::vector<struct ares_addr_port_node> nodes;
+        if (::ares_set_servers_ports(fresh, MakeServerNodes(servers, nodes)) != ARES_SUCCESS) {
+            ::ares_destroy(fresh);
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * ares refuses new servers under in-flight queries, so new queries go to a
+     * fresh ares channel and the old one is destroyed once it has drained.
+     */
+    bool ReplaceServers(ServerList servers, clock_type::duration try_timeout, int tries) {
+        native_handle_type fresh;
+        if (!NewGeneration(servers, try_timeout, tries, fresh)) {
+            return false;
+        }
+        Retire(fresh);
+        servers_ = std::move(servers);
+        try_timeout_ = try_timeout;
+        tries_ = tries;
+        return true;
+    }
+
+    /* fresh takes the new queries, channel_ joins the retired until it has drained */
+    void Retire(native_handle_type fresh) {
+        auto outstanding = record_requests_ + std::count_if(pending_.begin(), pending_.end(), [this](const typename PendingMap::value_type &query) {
+            return query.second.owner == channel_;
+        });
+        record_requests_ = 0;
+        auto old = channel_;
+        channel_ = fresh;
+        retired_.push_back(Generation{old, static_cast<int64_t>(outstanding), try_timeout_});
+        ReleaseGeneration(old, 0);
+    }
+
+    /* one query of owner is done; a drained old generation goes away after this turn */
+    void ReleaseGeneration(native_handle_type owner, int64_t done = 1) {
+        if (owner == channel_) {
+            return;
+        }
+        auto itr = std::find_if(retired_.begin(), retired_.end(), [owner](const Generation &generation) {
+            return generation.channel == owner;
+        });
+        itr->requests -= done;
+        if (itr->requests > 0) {
+            return;
+        }
+        retired_.erase(itr);
+        auto self{this->shared_from_this()};
+        boost::asio::post(strand_, BindArena(arena_, [self, owner]() {
+            ::ares_destroy(owner);
+        }));
+    }
+
+    /* a throwaway channel that only knows server, any answer proves it is up */
+    void StartProbe(const ServerAddress &server) {
+        native_handle_type probe;
+        if (!NewGeneration(ServerList{server}, timeout_, 1, probe)) {
+            health_.OnProbeCancelled(server);
+            return;
+        }
+        retired_.push_back(Generation{probe, 1, timeout_});
+        ++request_count_;
+        auto *query = new ProbeQuery{this->shared_from_this(), probe, server, clock_type::now()};
+        ::ares_query(probe, ".", 1 /* C_IN */, 2 /* T_NS */, &BasicChannel::ProbeCallback, query);
+        TimerStart();
+    }
+
+    static void ProbeCallback(void *arg, int status, int, unsigned char *, int) {
+        std::unique_ptr<ProbeQuery> query{static_cast<ProbeQuery *>(arg)};
+        auto &channel = query->channel;
+        if (status == ARES_ECANCELLED || status == ARES_EDESTRUCTION) {
+            channel->health_.OnProbeCancelled(query->server);
+        } else {
+            /* an error rcode is still an answer */
+            bool answered = (status != ARES_ETIMEOUT && status != ARES_ECONNREFUSED);
+            channel->health_.OnProbeDone(query->server, answered, clock_type::now() - query->started);
+        }
+        channel->ReleaseGeneration(query->owner);
+        if (--channel->request_count_ == 0) {
+            channel->TimerStop();
+        }
+        /* like HostCallback, the last reference must not go away inside ares */
+        auto self = std::move(query->channel);
+        auto &strand = self->strand_;
+        auto &arena = self->arena_;
+        boost::asio::post(strand, BindArena(arena, [self{std::move(self)}]() {
+            self->ApplyServers();
+        }));
+    }
+
+    template<class Results, class Handler>
+    static void RecordCallback(void *arg, int status, int, unsigned char *abuf, int alen) {
+        std::unique_ptr<RecordQuery<Results, Handler>> query{static_cast<RecordQuery<Results, Handler> *>(arg)};
+        auto &channel = query->channel;
+        boost::system::error_code ec;
+        if (status == ARES_SUCCESS) {
+            query->result->Assign(abuf, alen, ec);
+        } else {
+            ec.assign(status, error::get_category());
+        }
+        channel->TraceStep(trace_stage::answer, query->name.c_str(), AF_UNSPEC, ARES_SOCKET_BAD, ec);
+        auto &stats = channel->stats_;
+        bool answered = (status == ARES_SUCCESS || status == ARES_ENOTFOUND || status == ARES_ENODATA);
+        (answered ? stats.answers : stats.failures).fetch_add(1, std::memory_order_relaxed);
+        if (status == ARES_ETIMEOUT) {
+            stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (query->owner == channel->channel_) {
+            --channel->record_requests_;
+        }
+        channel->ReleaseGeneration(query->owner);
+        if (--channel->request_count_ == 0) {
+            channel->TimerStop();
+        }
+        stats.in_flight.store(channel->request_count_, std::memory_order_relaxed);
+
+        auto result = std::move(query->result);
+        auto handler = std::move(query->handler);
+        boost::asio::post(
+            channel->completion_context_,
+            BindArena(channel->arena_, [handler, ec, result]() {
+                (*handler)(ec, std::move(*result));
+            })
+        );
+        /* like HostCallback, the last reference must not go away inside ares */
+        auto self = std::move(query->channel);
+        auto &strand = self->strand_;
+        auto &arena = self->arena_;
+        boost::asio::post(strand, BindArena(arena, [self{std::move(self)}]() {
+            self->ApplyServers();
+            self->Rebalance();
+        }));
+    }
+
+    /* the udp sends of every socket that went unanswered past the timeout */
+    void SweepServerFailures() {
+        auto now = clock_type::now();
+        sockets_.ForEach([this, now](Socket &socket) {
+            for (auto expired = socket.TakeExpired(now, try_timeout_); expired != 0; --expired) {
+                health_.OnFailure(socket.peer_.address(), socket.peer_.port(), false);
+            }
+        });
+    }
+
+    void OnServerAnswer(const Socket &socket, clock_type::duration rtt) {
+        if (IsAdaptive()) {
+            health_.OnAnswer(socket.peer_.address(), socket.peer_.port(), rtt);
+        }
+    }
+
+    void OnServerRefused(const Socket &socket) {
+        if (IsAdaptive() && socket.server_) {
+            health_.OnFailure(socket.peer_.address(), socket.peer_.port(), true);
+        }
+    }
+
+    /* not one of ours is the RFC 6724 sort of an AF_UNSPEC answer looking up a source address */
+    bool IsServer(const boost::asio::ip::address &address, uint16_t port) const {
+        return std::any_of(servers_.begin(), servers_.end(), [&](const ServerAddress &server) {
+            return server.IsEndpoint(address, port);
+        });
+    }
+
+    /* channel_ first, copied since callbacks may retire generations */
+    boost::container::small_vector<native_handle_type, 4> Generations() const {
+        boost::container::small_vector<native_handle_type, 4> channels{channel_};
+        for (auto &generation : retired_) {
+            channels.push_back(generation.channel);
+        }
+        return channels;
+    }
+
+    void ProcessAll(ares_socket_t rd, ares_socket_t wr) {
+        ::ares_process_fd(channel_, rd, wr);
+        if (retired_.empty()) {
+            return;
+        }
+        auto channels = Generations();
+        for (size_t i = 1; i < channels.size(); ++i) {
+            ::ares_process_fd(channels[i], rd, wr);
+        }
+    }
+
+    template<class Results, class Callback>
+    void ResultHandler(boost::system::error_code ec, struct ares_addrinfo *entries, resolve_mode mode, clock_type::time_point started,
+                       std::shared_ptr<Results> &result, std::shared_ptr<Callback> cb, std::shared_ptr<MergeState> req) {
+        if (MergeResult(ec, entries, mode, *result, *req)) {
+            stats_.resolve_latency[mode].Record(clock_type::now() - started);
+            boost::asio::post(
+                completion_context_,
+                BindArena(arena_, [cb, ec, result]() {
+                    (*cb)(ec, std::move(*result));
+                })
+            );
+        }
+    }
+
+    template<class Table, class Callback>
+    void BatchResultHandler(boost::system::error_code ec, struct ares_addrinfo *entries, resolve_mode mode, std::shared_ptr<BatchRequest<Table, Callback>> &batch, size_t slot) {
+        auto &state = batch->slots[slot].second;
+        if (state.remain == 0) { /* the table may already belong to the handler */
+            return;
+        }
+        auto &entry = (*batch->table)[batch->slots[slot].first];
+        if (!MergeResult(ec, entries, mode, entry.results, state)) {
+            return;
+        }
+        entry.error = ec;
+        if (!ec) {
+            batch->resolved = true;
+        } else {
+            batch->error = ec;
+        }
+        if (--batch->outstanding == 0) {
+            if (batch->resolved) {
+                batch->error.clear();
             }
+            boost::asio::post(
+                completion_context_,
+                BindArena(arena_, [batch]() {
+                    (*batch->handler)(batch->error, batch->table);
+                })
+            );
+        }
+    }
+
+    template<class Results, class Callback>
+    void StreamResultHandler(boost::system::error_code ec, struct ares_addrinfo *entries, int family, resolve_mode mode, std::shared_ptr<StreamRequest<Results, Callback>> &stream) {
+        if (stream->finished) {
+            return;
+        }
+        --stream->remain;
+        MergeError(stream->error, ec);
+        Results answer{stream->prototype};
+        if (!ec) {
+            answer.Append(entries);
+        }
+
+        bool last = (stream->remain == 0);
+        if (mode == unspecific) {
+            if (!answer.IsEmpty() || last) {
+                StreamDeliver(stream, std::move(answer), false);
+            }
+            return;
+        }
+
+        if (stream->preferred == AF_UNSPEC || family == stream->preferred) {
+            if (stream->holding) {
+                stream->holding = false;
+                stream->timer.cancel();
+                answer.Append(stream->held);
+                StreamDeliver(stream, std::move(answer), false);
+            } else if (!answer.IsEmpty() || last) {
+                StreamDeliver(stream, std::move(answer), !last);
+            }
+            return;
+        }
+
+        /* the less preferred family: remain != 0 means the preferred one is still out */
+        if (answer.IsEmpty()) {
+            if (last) {
+                StreamDeliver(stream, std::move(answer), false);
+            }
+            return;
+        }
+        if (last || stream->delay.count() <= 0) {
+            StreamDeliver(stream, std::move(answer), !last);
+            return;
+        }
+        auto self{this->shared_from_this()};
+        stream->held = std::move(answer);
+        stream->holding = true;
+        stream->timer.expires_after(stream->delay);
+        stream->timer.async_wait(
+            boost::asio::bind_executor(
+                strand_,
+                BindArena(arena_, [this, self, stream](boost::system::error_code ec) {
+                    if (ec || !stream->holding || stream->finished) {
+                        return;
+                    }
+                    stream->holding = false;
+                    StreamDeliver(stream, std::move(stream->held), true);
+                })
+            )
         );
     }
 
     template<class Results, class Callback>
-    void ResultHandler(boost::system::error_code ec, struct hostent *entries, std::shared_ptr<Results> &result, std::shared_ptr<Callback> cb, std::shared_ptr<uint32_t> req) {
+    void StreamDeliver(const std::shared_ptr<StreamRequest<Results, Callback>> &stream, Results results, bool more) {
+        boost::system::error_code ec;
+        if (results.IsEmpty() && !stream->delivered) {
+            ec = stream->error;
+        }
+        stream->delivered = stream->delivered || !results.IsEmpty();
+        stream->finished = !more;
+        auto handler = stream->handler;
+        boost::asio::post(
+            stream->completion_strand,
+            BindArena(arena_, [handler, ec, results{std::move(results)}, more]() mutable {
+                (*handler)(ec, std::move(results), more);
+            })
+        );
+    }
+
+    /* a failure of either family is reported over a name error of the other, only those get negative cached */
+    static void MergeError(boost::system::error_code &merged, const boost::system::error_code &ec) {
+        if (ec && (!merged || (ResolveCache::IsUpstreamFailure(ec) && !ResolveCache::IsUpstreamFailure(merged)))) {
+            merged = ec;
+        }
+    }
+
+    /*
+     * Merges one family's answer into result, true once the lookup is complete
+     * and ec is what to report for it. remain drops to 0 on completion so late
+     * answers never touch a result that has already been handed over.
+     */
+    template<class Results>
+    static bool MergeResult(boost::system::error_code &ec, struct ares_addrinfo *entries, resolve_mode mode, Results &result, MergeState &state) {
         int family;
         bool need_prepend = false;
-        auto mode = GetResolveMode();
         bool should_invoke_cb = false;
-        --*req;
+        if (state.remain == 0) {
+            return false;
+        }
+        --state.remain;
+        MergeError(state.error, ec);
         switch (mode) {
         case unspecific:
-            if (!result->IsEmpty()) {
+            if (!result.IsEmpty()) {
                 break;
             }
-            if (!ec && result->IsEmpty()) {
-                result->Append(entries);
+            if (!ec && result.IsEmpty()) {
+                result.Append(entries);
             }
-            if (!result->IsEmpty() || *req == 0) {
+            if (!result.IsEmpty() || state.remain == 0) {
                 should_invoke_cb = true;
             }
             break;
@@ -273,26 +1563,24 @@ private:
         case ipv4_first:
         case ipv6_first:
         case both:
-            need_prepend = (mode != both) && result->LastFamily(family);
+            need_prepend = (mode != both) && result.LastFamily(family);
             need_prepend = \
                 need_prepend && (family == (mode == ipv4_first ? AF_INET6 : AF_INET));
             if (!ec && !need_prepend) {
-                result->Append(entries);
+                result.Append(entries);
             } else if (!ec && need_prepend) {
-                result->Prepend(entries);
+                result.Prepend(entries);
             }
-            if (*req == 0) {
-                if (!result->IsEmpty()) {
-                    ec.clear();
-                }
+            if (state.remain == 0) {
                 should_invoke_cb = true;
             }
             break;
 
         case ipv4_only:
         case ipv6_only:
+        case rfc6724:
             if (!ec) {
-                result->Append(entries);
+                result.Append(entries);
             }
             should_invoke_cb = true;
             break;
@@ -302,110 +1590,319 @@ private:
             break;
         };
         if (should_invoke_cb) {
-            boost::asio::post(
-                context_,
-                [cb, ec, result]() {
-                    (*cb)(ec, *result);
-                }
-            );
+            state.remain = 0;
+            ec = result.IsEmpty() ? state.error : boost::system::error_code{};
         }
+        return should_invoke_cb;
     }
 
+    /*
+     * Arms the timer for the earliest c-ares deadline, called after every
+     * submit and packet. Generations wait differently long and c-ares doubles
+     * the wait per round, so a new deadline can come before the armed one;
+     * none comes sooner than the shortest try timeout from now, when the
+     * armed timer is within that there is no need to ask c-ares again.
+     */
     void TimerStart() {
-        auto self{shared_from_this()};
-        last_tick_ = boost::posix_time::microsec_clock::local_time();
-        timer_.expires_from_now(timer_period_);
-        timer_.async_wait(std::bind(&Channel::TimerCallback, self, std::placeholders::_1));
+        if (timer_expiry_ != clock_type::time_point::max()) {
+            auto shortest = try_timeout_;
+            for (auto &generation : retired_) {
+                shortest = std::min(shortest, generation.try_timeout);
+            }
+            if (timer_expiry_ <= clock_type::now() + shortest) {
+                return;
+            }
+        }
+        struct timeval tv;
+        struct timeval *next = ::ares_timeout(channel_, nullptr, &tv);
+        for (auto &generation : retired_) {
+            struct timeval other;
+            if (::ares_timeout(generation.channel, next, &other) == &other) {
+                tv = other;
+                next = &tv;
+            }
+        }
+        if (!next) {
+            return;
+        }
+        auto expiry = clock_type::now() + std::chrono::seconds{tv.tv_sec} + std::chrono::microseconds{tv.tv_usec};
+        if (expiry >= timer_expiry_) {
+            return;
+        }
+        auto self{this->shared_from_this()};
+        /* expires_at aborts a wait already armed, its callback sees operation_aborted */
+        timer_expiry_ = expiry;
+        timer_.expires_at(timer_expiry_);
+        timer_.async_wait(
+            boost::asio::bind_executor(
+                strand_, BindArena(arena_, std::bind(&BasicChannel::TimerCallback, self, std::placeholders::_1))
+            )
+        );
     }
 
     void TimerStop() {
+        timer_expiry_ = clock_type::time_point::max();
         timer_.cancel();
     }
 
     void TimerCallback(boost::system::error_code ec) {
-        auto self{shared_from_this()};
-        auto now = boost::posix_time::microsec_clock::local_time();
-        auto after = last_tick_ - now + timer_period_;
-        if (after.is_negative() || after == boost::posix_time::millisec{0}) {
-            last_tick_ = boost::posix_time::microsec_clock::local_time();
-            ProcessFd(ARES_SOCKET_BAD, ARES_SOCKET_BAD);
-            after = timer_period_;
+        /* aborted, or a stale wake left over from a cancel */
+        if (ec || clock_type::now() < timer_expiry_) {
+            return;
+        }
+        timer_expiry_ = clock_type::time_point::max();
+        bool adaptive = IsAdaptive();
+        if (adaptive) {
+            SweepServerFailures();
         }
-        if (!ec && request_count_) {
-            timer_.expires_from_now(after);
-            timer_.async_wait(std::bind(&Channel::TimerCallback, self, std::placeholders::_1));
+        ProcessAll(ARES_SOCKET_BAD, ARES_SOCKET_BAD);
+        if (adaptive) {
+            Rebalance();
+        }
+        if (request_count_ != 0) {
+            TimerStart();
+        }
+    }
+
+    /* an answer may have sent its query on to the next server, with a new deadline */
+    void RearmAfterAnswers() {
+        if (request_count_ != 0) {
+            TimerStart();
         }
     }
 
     void ProcessFd(ares_socket_t rd, ares_socket_t wr) {
-        auto self{shared_from_this()};
-        boost::asio::post(
+        auto self{this->shared_from_this()};
+        boost::asio::dispatch(
             strand_,
             [this, self, rd, wr]() {
-                last_tick_ = boost::posix_time::microsec_clock::local_time();
-                ::ares_process_fd(channel_, rd, wr);
+                TraceStep(trace_stage::wake, nullptr, AF_UNSPEC, rd != ARES_SOCKET_BAD ? rd : wr);
+                if (!coalesce_readiness_.load(std::memory_order_relaxed)) {
+                    ProcessAll(rd, wr);
+                    RearmAfterAnswers();
+                    return;
+                }
+                /* gather everything that becomes ready in this turn, drain it once */
+                if (rd != ARES_SOCKET_BAD) {
+                    ready_read_.push_back(rd);
+                }
+                if (wr != ARES_SOCKET_BAD) {
+                    ready_write_.push_back(wr);
+                }
+                if (!drain_pending_) {
+                    drain_pending_ = true;
+                    boost::asio::post(strand_, BindArena(arena_, std::bind(&BasicChannel::DrainReady, self)));
+                }
             }
         );
     }
 
-    static void HostCallback(void *arg, int status, int timeouts, struct hostent *hostent) {
-        std::unique_ptr<ChannelComplete> comp;
-        comp.reset(static_cast<ChannelComplete *>(arg));
+    void DrainReady() {
+        drain_pending_ = false;
+        std::vector<ares_socket_t> reads, writes;
+        reads.swap(ready_read_);
+        writes.swap(ready_write_);
+
+        fd_set read_fds, write_fds;
+        FD_ZERO(&read_fds);
+        FD_ZERO(&write_fds);
+        bool fits = FitsFdSet(reads) && FitsFdSet(writes);
+        if (fits) {
+            for (auto fd : reads) {
+                FD_SET(fd, &read_fds);
+            }
+            for (auto fd : writes) {
+                FD_SET(fd, &write_fds);
+            }
+            for (auto channel : Generations()) {
+                ::ares_process(channel, &read_fds, &write_fds);
+            }
+        } else {
+            for (auto fd : reads) {
+                ProcessAll(fd, ARES_SOCKET_BAD);
+            }
+            for (auto fd : writes) {
+                ProcessAll(ARES_SOCKET_BAD, fd);
+            }
+        }
+        RearmAfterAnswers();
+        /* hand the buffers back so steady state allocates nothing */
+        reads.clear();
+        writes.clear();
+        if (ready_read_.empty()) {
+            ready_read_.swap(reads);
+        }
+        if (ready_write_.empty()) {
+            ready_write_.swap(writes);
+        }
+    }
+
+    /* sends queued during this strand turn go out together once it is over */
+    void ScheduleFlush(ares_socket_t fd) {
+        flush_fds_.push_back(fd);
+        if (!flush_pending_) {
+            flush_pending_ = true;
+            boost::asio::post(strand_, BindArena(arena_, std::bind(&BasicChannel::FlushDatagrams, this->shared_from_this())));
+        }
+    }
+
+    void FlushDatagrams() {
+        flush_pending_ = false;
+#if defined(__linux__)
+        for (auto fd : flush_fds_) {
+            auto socket = sockets_.Find(fd);
+            if (socket && socket->batch_) {
+                socket->batch_->Flush(fd);
+            }
+        }
+#endif
+        flush_fds_.clear();
+    }
+
+    void TraceStep(trace_stage stage, const char *name, int family, ares_socket_t fd, boost::system::error_code ec = {}) {
+        if (Trace::enabled) {
+            trace_(TraceEvent{stage, clock_type::now(), 0, name, family, fd, ec});
+        }
+    }
+
+    static bool FitsFdSet(const std::vector<ares_socket_t> &fds) {
+#if defined(_WIN32) && !defined(__CYGWIN__)
+        return fds.size() <= FD_SETSIZE;
+#else
+        return std::all_of(fds.begin(), fds.end(), [](ares_socket_t fd) { return fd < FD_SETSIZE; });
+#endif
+    }
+
+    static void HostCallback(void *arg, int status, int timeouts, struct ares_addrinfo *entries) {
+        auto &query = *static_cast<typename PendingMap::value_type *>(arg);
         boost::system::error_code ec;
         if (status != ARES_SUCCESS) {
             ec.assign(status, error::get_category());
         }
-        comp->callback(ec, hostent);
-        auto channel = comp->channel;
+        auto channel = std::move(query.second.channel);
+        channel->TraceStep(trace_stage::answer, query.first.first.c_str(), query.first.second, ARES_SOCKET_BAD, ec);
+        auto &stats = channel->stats_;
+        auto family = query.first.second;
+        auto &latency = (family == AF_INET6) ? stats.ipv6_latency : (family == AF_UNSPEC) ? stats.dual_latency : stats.ipv4_latency;
+        latency.Record(clock_type::now() - query.second.started);
+        /* a name error is still an answer */
+        bool answered = (status == ARES_SUCCESS || status == ARES_ENOTFOUND || status == ARES_ENODATA);
+        (answered ? stats.answers : stats.failures).fetch_add(1, std::memory_order_relaxed);
+        if (status == ARES_ETIMEOUT) {
+            stats.timeouts.fetch_add(1, std::memory_order_relaxed);
+        }
+        auto &pending = channel->pending_;
+        auto owner = query.second.owner;
+        auto callbacks{std::move(query.second.callbacks)};
+        pending.erase(pending.find(query.first));
+        for (auto &callback : callbacks) {
+            callback(ec, entries);
+        }
+        ::ares_freeaddrinfo(entries);
+        channel->ReleaseGeneration(owner);
+
+        /* always called on the strand, from inside an ares_* call */
+        if (--channel->request_count_ == 0) {
+            channel->TimerStop();
+        }
+        if (!channel->waiting_.empty()) {
+            channel->Admit();
+        }
+        stats.in_flight.store(channel->request_count_, std::memory_order_relaxed);
+        /* the last reference must not go away inside ares_process_fd */
+        auto &strand = channel->strand_;
+        auto &arena = channel->arena_;
         boost::asio::post(
-            channel->strand_,
-            [comp{std::move(comp)}]() {
-                comp->channel->request_count_--;
-                if (comp->channel->request_count_ == 0) {
-                    comp->channel->TimerStop();
-                }
-            }
+            strand,
+            BindArena(arena, [channel{std::move(channel)}]() {
+                channel->ApplyServers();
+                channel->Rebalance();
+            })
         );
     }
 
     boost::asio::io_context &context_;
+    boost::asio::io_context &completion_context_;
     boost::asio::io_context::strand strand_;
     native_handle_type channel_;
-    boost::asio::deadline_timer timer_;
-    boost::posix_time::time_duration timer_period_;
-    boost::posix_time::ptime last_tick_;
+    std::vector<Generation> retired_; /* still draining, destroyed once empty */
+    boost::asio::steady_timer timer_;
+    clock_type::time_point timer_expiry_;
+    clock_type::duration timeout_;     /* as configured, the budget for all tries */
+    clock_type::duration try_timeout_; /* what channel_ waits per try */
+    int tries_;
+    std::shared_ptr<RecyclingArena> arena_;
     std::shared_ptr<struct ares_socket_functions> functions_;
-    std::map<ares_socket_t, std::shared_ptr<Socket>> sockets_;
+    SocketTable sockets_;
+    PendingMap pending_;
+    WaitingQueue waiting_; /* FIFO of pending_ entries without a slot */
+    ServerList pending_servers_;
+    ServerList servers_; /* what channel_ tries, in its order */
+    ServerHealth health_;
+    clock_type::time_point next_rebalance_;
+    clock_type::time_point next_retune_;
     int64_t request_count_;
-    resolve_mode resolve_mode_;
-
-    friend ares_socket_t OpenSocket(int family, int type, int protocol, void *arg);
-    friend int CloseSocket(ares_socket_t fd, void *arg);
-    friend int ConnectSocket(ares_socket_t fd, const struct sockaddr *addr, ares_socklen_t len, void *arg);
-    friend ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags, struct sockaddr *addr, ares_socklen_t *addr_len, void *arg);
-    friend ares_ssize_t SendSocket(ares_socket_t fd, const struct iovec *data, int len, void *arg);
-    friend void SocketStateCb(void *arg, ares_socket_t fd, int readable, int writeable);
+    int64_t record_requests_; /* AsyncQuery on channel_, handed to its Generation on retirement */
+    std::atomic<resolve_mode> resolve_mode_;
+    std::atomic<std::chrono::milliseconds::rep> resolution_delay_;
+    std::atomic<bool> coalesce_readiness_;
+    std::vector<ares_socket_t> ready_read_;
+    std::vector<ares_socket_t> ready_write_;
+    bool drain_pending_;
+    std::atomic<bool> batch_datagrams_;
+    std::vector<ares_socket_t> flush_fds_;
+    bool flush_pending_;
+    std::shared_ptr<ResolveCache> cache_;
+    std::shared_ptr<HostsTable> hosts_;
+    std::atomic<bool> adaptive_servers_;
+    std::atomic<bool> adaptive_timeout_;
+    std::atomic<size_t> max_in_flight_;
+    std::atomic<size_t> max_waiting_;
+    bool admitting_;
+    boost::asio::steady_timer config_timer_;
+    std::string config_path_; /* empty for the system default */
+    std::string config_text_; /* what config_path_ held at the last look */
+    uint64_t config_watch_;   /* bumped per WatchConfig, older timers stand down */
+    std::atomic<std::chrono::milliseconds::rep> config_interval_;
+    bool explicit_servers_;
+    bool servers_pending_; /* pending_servers_ waits to be applied, it may be empty */
+    bool ares_reads_hosts_; /* lookups "bf", false while hosts_ answers for the file */
+    ChannelStats stats_;
+    Trace trace_;
+
+    friend ares_socket_t OpenSocket<BasicChannel>(int family, int type, int protocol, void *arg);
+    friend int CloseSocket<BasicChannel>(ares_socket_t fd, void *arg);
+    friend int ConnectSocket<BasicChannel>(ares_socket_t fd, const struct sockaddr *addr, ares_socklen_t len, void *arg);
+    friend ares_ssize_t ReadSocket<BasicChannel>(ares_socket_t fd, void *data, size_t data_len, int flags, struct sockaddr *addr, ares_socklen_t *addr_len, void *arg);
+    friend ares_ssize_t SendSocket<BasicChannel>(ares_socket_t fd, const struct iovec *data, int len, void *arg);
+    friend void SocketStateCb<BasicChannel>(void *arg, ares_socket_t fd, int readable, int writeable);
 };
 
+using Channel = BasicChannel<>;
+
+template<class Channel>
 std::shared_ptr<struct ares_socket_functions> GetSocketFunctions() {
     static std::shared_ptr<struct ares_socket_functions> funcs = \
         []() {
             auto result = std::make_shared<struct ares_socket_functions>();
-            result->asocket   = OpenSocket;
-            result->aclose    = CloseSocket;
-            result->aconnect  = ConnectSocket;
-            result->arecvfrom = ReadSocket;
-            result->asendv    = SendSocket;
+            result->asocket   = OpenSocket<Channel>;
+            result->aclose    = CloseSocket<Channel>;
+            result->aconnect  = ConnectSocket<Channel>;
+            result->arecvfrom = ReadSocket<Channel>;
+            result->asendv    = SendSocket<Channel>;
             return result;
         }();
     return funcs;
 }
 
-char *GetAresLookups() {
-    static char lookups[] = "bf";
-    return lookups;
+/* "b" only while a HostsTable answers for the file, c-ares would scan it after every failed lookup */
+char *GetAresLookups(bool files) {
+    static char dns_and_files[] = "bf";
+    static char dns[] = "b";
+    return files ? dns_and_files : dns;
 }
 
+template<class Channel>
 ares_socket_t OpenSocket(int family, int type, int protocol, void *arg) {
     auto channel = static_cast<Channel *>(arg);
     auto &context = channel->context_;
@@ -422,8 +1919,7 @@ ares_socket_t OpenSocket(int family, int type, int protocol, void *arg) {
         if (ec) { goto __open_socket_final_state; }
 
         result = sock.native_handle();
-        auto ptr = std::make_shared<Channel::Socket>(std::move(sock));
-        channel->sockets_.emplace(result, ptr);
+        channel->sockets_.Insert(result, std::allocate_shared<typename Channel::Socket>(channel->GetAllocator(), std::move(sock), channel->strand_, channel->arena_));
     } else if (type == SOCK_DGRAM) {
         boost::asio::ip::udp::socket sock{context};
         auto af = (family == AF_INET) ? boost::asio::ip::udp::v4() : boost::asio::ip::udp::v6();
@@ -434,8 +1930,7 @@ ares_socket_t OpenSocket(int family, int type, int protocol, void *arg) {
         if (ec) { goto __open_socket_final_state; }
 
         result = sock.native_handle();
-        auto ptr = std::make_shared<Channel::Socket>(std::move(sock));
-        channel->sockets_.emplace(result, ptr);
+        channel->sockets_.Insert(result, std::allocate_shared<typename Channel::Socket>(channel->GetAllocator(), std::move(sock), channel->strand_, channel->arena_));
     } else {
         assert(false);
     }
@@ -445,43 +1940,65 @@ __open_socket_final_state:
         SET_SOCKERRNO(ec.value());
         return -1;
     }
+    /* udp counts as opened at connect, once it is known to go to a server */
+    auto &stats = channel->stats_;
+    stats.open_sockets.fetch_add(1, std::memory_order_relaxed);
+    if (type == SOCK_STREAM) {
+        stats.sockets_opened.fetch_add(1, std::memory_order_relaxed);
+        stats.tcp_connections.fetch_add(1, std::memory_order_relaxed);
+    }
     return result;
 }
 
+template<class Channel>
 int CloseSocket(ares_socket_t fd, void *arg) {
     auto channel = static_cast<Channel *>(arg);
     auto &sockets = channel->sockets_;
-    auto itr = sockets.find(fd);
-    itr->second->Close();
-    sockets.erase(itr);
+    auto self = sockets.Find(fd);
+#if defined(__linux__)
+    /* queries c-ares already counts as sent still go out */
+    if (self->batch_ && self->batch_->HasQueued()) {
+        self->batch_->Flush(fd);
+    }
+#endif
+    self->Close();
+    sockets.Erase(fd);
+    channel->stats_.open_sockets.fetch_sub(1, std::memory_order_relaxed);
     return 0;
 }
 
+template<class Channel>
 int ConnectSocket(ares_socket_t fd, const struct sockaddr *addr, ares_socklen_t addr_len, void *arg) {
     auto channel = static_cast<Channel *>(arg);
-    auto itr = channel->sockets_.find(fd);
-    auto self{itr->second};
+    auto self = channel->sockets_.Find(fd);
     boost::system::error_code ec;
 
     if (self->IsTcp()) {
         boost::asio::ip::tcp::endpoint ep;
         ep.resize(addr_len);
         memcpy(ep.data(), addr, addr_len);
+        self->peer_ = ep;
         self->GetTcp().connect(ep, ec);
     } else {
         boost::asio::ip::udp::endpoint ep;
         ep.resize(addr_len);
         memcpy(ep.data(), addr, addr_len);
+        self->peer_ = boost::asio::ip::tcp::endpoint{ep.address(), ep.port()};
+        /* a sort probe only connects to learn its source address, it gets no stats entry */
+        if (channel->IsServer(ep.address(), ep.port())) {
+            self->server_ = channel->stats_.GetServer(ep.address(), ep.port());
+            channel->stats_.sockets_opened.fetch_add(1, std::memory_order_relaxed);
+        }
         self->GetUdp().connect(ep, ec);
     }
     SET_SOCKERRNO(ec.value());
     return (ec ? -1 : 0);
 }
 
+template<class Channel>
 ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags, struct sockaddr *addr, ares_socklen_t *addr_len, void *arg) {
     auto channel = static_cast<Channel *>(arg);
-    auto itr = channel->sockets_.find(fd);
-    auto self{itr->second};
+    auto self = channel->sockets_.Find(fd);
     boost::system::error_code ec;
 
     ares_ssize_t result = -1;
@@ -489,11 +2006,24 @@ ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags
         auto &socket = self->GetTcp();
         result = socket.read_some(boost::asio::buffer(data, data_len), ec);
         if (!ec && addr) {
-            auto ep = socket.remote_endpoint();
+            auto &ep = self->peer_;
             *addr_len = ep.size();
             memcpy(addr, ep.data(), ep.size());
         }
     } else {
+#if defined(__linux__)
+        /* a partly handed out batch is finished even if batching was just switched off */
+        if (self->batch_ || channel->batch_datagrams_.load(std::memory_order_relaxed)) {
+            result = self->Batch().Read(fd, data, data_len, addr, addr_len);
+            typename Channel::clock_type::duration rtt;
+            if (result > 0 && self->NoteAnswer(data, result, rtt)) {
+                channel->OnServerAnswer(*self, rtt);
+            } else if (result < 0 && errno == ECONNREFUSED) {
+                channel->OnServerRefused(*self);
+            }
+            return result;
+        }
+#endif
         auto &socket = self->GetUdp();
         boost::asio::ip::udp::endpoint ep;
         result = socket.receive_from(boost::asio::buffer(data, data_len), ep, flags, ec);
@@ -501,38 +2031,63 @@ ares_ssize_t ReadSocket(ares_socket_t fd, void *data, size_t data_len, int flags
             *addr_len = ep.size();
             memcpy(addr, ep.data(), ep.size());
         }
+        typename Channel::clock_type::duration rtt;
+        if (!ec && result > 0 && self->NoteAnswer(data, result, rtt)) {
+            channel->OnServerAnswer(*self, rtt);
+        } else if (ec == boost::asio::error::connection_refused) {
+            channel->OnServerRefused(*self);
+        }
     }
     SET_SOCKERRNO(ec.value());
     return (ec ? -1 : result);
 }
 
+template<class Channel>
 ares_ssize_t SendSocket(ares_socket_t fd, const struct iovec *data, int len, void *arg) {
     auto channel = static_cast<Channel *>(arg);
-    auto itr = channel->sockets_.find(fd);
-    auto self{itr->second};
+    auto self = channel->sockets_.Find(fd);
     boost::system::error_code ec;
 
     ares_ssize_t result = -1;
-    std::vector<boost::asio::mutable_buffer> buf_seq;
-    buf_seq.reserve(len);
+#if defined(__linux__)
+    if (!self->IsTcp() && channel->batch_datagrams_.load(std::memory_order_relaxed)) {
+        auto &batch = self->Batch();
+        bool first = !batch.HasQueued();
+        if (batch.IsFull()) {
+            batch.Flush(fd);
+        }
+        if (batch.Queue(data, len, result)) {
+            if (first) {
+                channel->ScheduleFlush(fd);
+            }
+            self->NoteSend(data, len);
+            return result;
+        }
+    }
+#endif
+    /* c-ares sends one or two iovecs (tcp length prefix + query), keep them on the stack */
+    boost::container::small_vector<boost::asio::const_buffer, 4> buf_seq;
     for (int i = 0; i < len; ++i) {
-        buf_seq.push_back(boost::asio::buffer(data[i].iov_base, data[i].iov_len));
+        buf_seq.emplace_back(data[i].iov_base, data[i].iov_len);
     }
     if (self->IsTcp()) {
         auto &socket = self->GetTcp();
-        result = socket.write_some(std::move(buf_seq), ec);
+        result = socket.write_some(buf_seq, ec);
     } else {
         auto &socket = self->GetUdp();
-        result = socket.send(std::move(buf_seq), 0, ec);
+        result = socket.send(buf_seq, 0, ec);
+        if (!ec) {
+            self->NoteSend(data, len);
+        }
     }
     SET_SOCKERRNO(ec.value());
     return (ec ? -1 : result);
 }
 
+template<class Channel>
 void SocketStateCb(void *arg, ares_socket_t fd, int readable, int writeable) {
     auto channel = static_cast<Channel *>(arg);
-    auto itr = channel->sockets_.find(fd);
-    auto self{itr->second};
+    auto self = channel->sockets_.Find(fd);
 
     self->Cancel();
     if (readable) {
@@ -0,0 +1,399 @@
+#ifndef __CARES_SERVICES_CHANNEL_POOL_HXX__
+#define __CARES_SERVICES_CHANNEL_POOL_HXX__
+
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+
+#include "error.hxx"
+#include "cache.hxx"
+#include "hosts.hxx"
+#include "channel.hxx"
+#include "servers.hxx"
+#include "stats.hxx"
+#include "trace.hxx"
+#include "resolve_mode.hxx"
+
+namespace cares {
+namespace detail {
+
+/* same name, same channel: keeps in-flight coalescing effective */
+struct HashSelect {
+    size_t operator()(const std::string &name, size_t size) {
+        return std::hash<std::string>{}(name) % size;
+    }
+};
+
+struct RoundRobinSelect {
+    size_t operator()(const std::string &, size_t size) {
+        return next_.fetch_add(1, std::memory_order_relaxed) % size;
+    }
+
+    std::atomic<size_t> next_{0};
+};
+
+/*
+ * Drop-in ChannelImplementation for base_cares_service that spreads queries
+ * over several Channels, each with its own ares_channel and strand. Trace
+ * is handed on to every channel, see BasicChannel.
+ */
+template<class Select = HashSelect, class Trace = NoTrace>
+class ChannelPool {
+public:
+    using channel_type = BasicChannel<Trace>;
+    using resolve_mode = typename channel_type::resolve_mode;
+    using native_handle_type = typename channel_type::native_handle_type;
+    using allocator_type = typename channel_type::allocator_type;
+    using trace_type = Trace;
+
+    ChannelPool(const ChannelPool &) = delete;
+    explicit ChannelPool(boost::asio::io_context &ios, size_t size = 0)
+        : context_(ios), arena_(std::make_shared<RecyclingArena>()) {
+        if (size == 0) {
+            size = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (size_t i = 0; i < size; ++i) {
+            channels_.emplace_back(std::make_shared<channel_type>(context_, context_, arena_));
+        }
+    }
+
+    ~ChannelPool() = default;
+
+    /* mode is empty or the FixedMode tag, passed on as is */
+    template<class Results, class Handler, class... Mode>
+    void AsyncGetHostByName(const std::string &domain, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler, Mode... mode) {
+        auto &channel = channels_[select_(domain, channels_.size())];
+        if (!pinned_) {
+            channel->AsyncGetHostByName(domain, result, handler, mode...);
+            return;
+        }
+        /* the lookup runs elsewhere, keep our own context busy until it completes */
+        auto guarded = std::allocate_shared<WorkHandler<Handler>>(
+            GetAllocator(), WorkHandler<Handler>{boost::asio::make_work_guard(context_), std::move(handler)}
+        );
+        channel->AsyncGetHostByName(domain, result, guarded, mode...);
+    }
+
+    template<class Results, class Handler>
+    void AsyncGetHostByNameStream(const std::string &domain, std::shared_ptr<Results> prototype, std::shared_ptr<Handler> handler) {
+        auto &channel = channels_[select_(domain, channels_.size())];
+        if (!pinned_) {
+            channel->AsyncGetHostByNameStream(domain, prototype, handler);
+            return;
+        }
+        auto guarded = std::allocate_shared<WorkHandler<Handler>>(
+            GetAllocator(), WorkHandler<Handler>{boost::asio::make_work_guard(context_), std::move(handler)}
+        );
+        channel->AsyncGetHostByNameStream(domain, prototype, guarded);
+    }
+
+    /* splits the batch per channel and completes once every part is back */
+    template<class Table, class Handler>
+    void AsyncGetHostByNameBatch(std::vector<std::pair<size_t, std::string>> names, std::shared_ptr<Table> table, std::shared_ptr<Handler> handler) {
+        std::vector<std::vector<std::pair<size_t, std::string>>> parts(channels_.size());
+        for (auto &name : names) {
+            parts[select_(name.second, channels_.size())].emplace_back(std::move(name));
+        }
+
+        auto join = std::make_shared<BatchJoin<Handler>>();
+        join->handler = std::move(handler);
+        join->outstanding = std::count_if(parts.begin(), parts.end(), [](auto &part) { return !part.empty(); });
+        join->resolved = false;
+        if (pinned_) {
+            join->work.emplace_back(boost::asio::make_work_guard(context_));
+        }
+        auto part_handler = std::make_shared<std::function<void(boost::system::error_code, std::shared_ptr<Table>)>>(
+            [join, table](boost::system::error_code ec, std::shared_ptr<Table>) {
+                /* every part filled disjoint entries of the shared table */
+                std::unique_lock<std::mutex> lock{join->mutex};
+                if (!ec) {
+                    join->resolved = true;
+                } else {
+                    join->error = ec;
+                }
+                if (--join->outstanding != 0) {
+                    return;
+                }
+                lock.unlock();
+                if (join->resolved) {
+                    join->error.clear();
+                }
+                (*join->handler)(join->error, table);
+                join->work.clear();
+            }
+        );
+        for (size_t i = 0; i < parts.size(); ++i) {
+            if (!parts[i].empty()) {
+                channels_[i]->AsyncGetHostByNameBatch(std::move(parts[i]), table, part_handler);
+            }
+        }
+    }
+
+    template<class Results, class Handler>
+    void AsyncQuery(const std::string &name, int type, query_scope scope, std::shared_ptr<Results> result, std::shared_ptr<Handler> handler) {
+        auto &channel = channels_[select_(name, channels_.size())];
+        if (!pinned_) {
+            channel->AsyncQuery(name, type, scope, result, handler);
+            return;
+        }
+        auto guarded = std::allocate_shared<WorkHandler<Handler>>(
+            GetAllocator(), WorkHandler<Handler>{boost::asio::make_work_guard(context_), std::move(handler)}
+        );
+        channel->AsyncQuery(name, type, scope, result, guarded);
+    }
+
+    void Cancel() {
+        for (auto &channel : channels_) {
+            channel->Cancel();
+        }
+    }
+
+    void SetServerPortsCsv(const std::string &servers, boost::system::error_code &ec) {
+        ec.clear();
+        ServerList list;
+        if (!ParseServersCsv(servers, list)) {
+            ec.assign(error::bad_string, error::get_category());
+            return;
+        }
+        if (list.empty()) {
+            return;
+        }
+        servers_ = list;
+        for (auto &channel : channels_) {
+            channel->SetServers(list);
+        }
+    }
+
+    void SetResolveMode(resolve_mode mode, boost::system::error_code &ec) {
+        for (auto &channel : channels_) {
+            channel->SetResolveMode(mode, ec);
+            if (ec) {
+                return;
+            }
+        }
+    }
+
+    resolve_mode GetResolveMode() const {
+        return channels_.front()->GetResolveMode();
+    }
+
+    void SetResolutionDelay(std::chrono::milliseconds delay) {
+        for (auto &channel : channels_) {
+            channel->SetResolutionDelay(delay);
+        }
+    }
+
+    std::chrono::milliseconds GetResolutionDelay() const {
+        return channels_.front()->GetResolutionDelay();
+    }
+
+    void SetCoalesceReadiness(bool enable) {
+        for (auto &channel : channels_) {
+            channel->SetCoalesceReadiness(enable);
+        }
+    }
+
+    bool GetCoalesceReadiness() const {
+        return channels_.front()->GetCoalesceReadiness();
+    }
+
+    void SetBatchDatagrams(bool enable) {
+        for (auto &channel : channels_) {
+            channel->SetBatchDatagrams(enable);
+        }
+    }
+
+    bool GetBatchDatagrams() const {
+        return channels_.front()->GetBatchDatagrams();
+    }
+
+    /* every channel keeps its own server health */
+    void SetAdaptiveServers(bool enable) {
+        for (auto &channel : channels_) {
+            channel->SetAdaptiveServers(enable);
+        }
+    }
+
+    bool GetAdaptiveServers() const {
+        return channels_.front()->GetAdaptiveServers();
+    }
+
+    void SetAdaptiveTimeout(bool enable) {
+        for (auto &channel : channels_) {
+            channel->SetAdaptiveTimeout(enable);
+        }
+    }
+
+    bool GetAdaptiveTimeout() const {
+        return channels_.front()->GetAdaptiveTimeout();
+    }
+
+    /* the limits hold per channel, the pool admits Size() times as much */
+    void SetMaxInFlight(size_t limit) {
+        for (auto &channel : channels_) {
+            channel->SetMaxInFlight(limit);
+        }
+    }
+
+    size_t GetMaxInFlight() const {
+        return channels_.front()->GetMaxInFlight();
+    }
+
+    void SetMaxWaiting(size_t limit) {
+        for (auto &channel : channels_) {
+            channel->SetMaxWaiting(limit);
+        }
+    }
+
+    size_t GetMaxWaiting() const {
+        return channels_.front()->GetMaxWaiting();
+    }
+
+    void ReloadConfig() {
+        for (auto &channel : channels_) {
+            channel->ReloadConfig();
+        }
+    }
+
+    /* every channel watches on its own, each reload is local to it */
+    void WatchConfig(std::chrono::milliseconds interval, std::string path) {
+        for (auto &channel : channels_) {
+            channel->WatchConfig(interval, path);
+        }
+        config_path_ = std::move(path);
+    }
+
+    std::chrono::milliseconds GetConfigWatch() const {
+        return channels_.front()->GetConfigWatch();
+    }
+
+    void SetCache(std::shared_ptr<ResolveCache> cache) {
+        for (auto &channel : channels_) {
+            channel->SetCache(cache);
+        }
+    }
+
+    std::shared_ptr<ResolveCache> GetCache() const {
+        return channels_.front()->GetCache();
+    }
+
+    void SetHosts(std::shared_ptr<HostsTable> hosts) {
+        for (auto &channel : channels_) {
+            channel->SetHosts(hosts);
+        }
+    }
+
+    std::shared_ptr<HostsTable> GetHosts() const {
+        return channels_.front()->GetHosts();
+    }
+
+    /* summed over every channel, servers are merged by address */
+    StatsSnapshot GetStats() const {
+        StatsSnapshot stats;
+        for (auto &channel : channels_) {
+            stats.Merge(channel->GetStats());
+        }
+        return stats;
+    }
+
+    /* one arena for the whole pool */
+    allocator_type GetAllocator() const {
+        return allocator_type{arena_};
+    }
+
+    /* only the first channel, the others are configured the same way */
+    native_handle_type GetNativeHandle() {
+        return channels_.front()->GetNativeHandle();
+    }
+
+    /*
+     * Rebuilds the pool with one channel per context, results are still posted
+     * to the resolver's own context. Not safe against concurrent resolves,
+     * call it while setting the resolver up.
+     */
+    void SetContexts(const std::vector<boost::asio::io_context *> &contexts) {
+        if (contexts.empty()) {
+            return;
+        }
+        auto mode = GetResolveMode();
+        auto delay = GetResolutionDelay();
+        auto coalesce = GetCoalesceReadiness();
+        auto batch = GetBatchDatagrams();
+        auto adaptive = GetAdaptiveServers();
+        auto adaptive_timeout = GetAdaptiveTimeout();
+        auto max_in_flight = GetMaxInFlight();
+        auto max_waiting = GetMaxWaiting();
+        auto config_watch = GetConfigWatch();
+        auto cache = GetCache();
+        auto hosts = GetHosts();
+        boost::system::error_code ec;
+
+        std::vector<std::shared_ptr<channel_type>> channels;
+        for (auto *context : contexts) {
+            auto channel = std::make_shared<channel_type>(*context, context_, arena_);
+            channel->SetResolveMode(mode, ec);
+            channel->SetResolutionDelay(delay);
+            channel->SetCoalesceReadiness(coalesce);
+            channel->SetBatchDatagrams(batch);
+            channel->SetAdaptiveServers(adaptive);
+            channel->SetAdaptiveTimeout(adaptive_timeout);
+            channel->SetMaxInFlight(max_in_flight);
+            channel->SetMaxWaiting(max_waiting);
+            if (config_watch.count() > 0) {
+                channel->WatchConfig(config_watch, config_path_);
+            }
+            channel->SetCache(cache);
+            channel->SetHosts(hosts);
+            if (!servers_.empty()) {
+                channel->SetServers(servers_);
+            }
+            channels.emplace_back(std::move(channel));
+        }
+        /* queries still running keep their old channel alive until they finish */
+        channels_ = std::move(channels);
+        pinned_ = true;
+    }
+
+    size_t Size() const {
+        return channels_.size();
+    }
+
+private:
+    template<class Handler>
+    struct WorkHandler {
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work;
+        std::shared_ptr<Handler> handler;
+
+        template<class... Args>
+        void operator()(Args &&...args) {
+            (*handler)(std::forward<Args>(args)...);
+        }
+    };
+
+    template<class Handler>
+    struct BatchJoin {
+        std::mutex mutex;
+        std::shared_ptr<Handler> handler;
+        size_t outstanding;
+        bool resolved;
+        boost::system::error_code error;
+        std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> work;
+    };
+
+    boost::asio::io_context &context_;
+    std::shared_ptr<RecyclingArena> arena_;
+    std::vector<std::shared_ptr<channel_type>> channels_;
+    bool pinned_ = false;
+    ServerList servers_;
+    std::string config_path_; /* what WatchConfig was last given */
+    Select select_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_CHANNEL_POOL_HXX__
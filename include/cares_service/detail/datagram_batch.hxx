@@ -0,0 +1,152 @@
+#ifndef __CARES_SERVICES_DATAGRAM_BATCH_HXX__
+#define __CARES_SERVICES_DATAGRAM_BATCH_HXX__
+
+#if defined(__linux__)
+
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <sys/socket.h>
+#include <ares.h>
+
+namespace cares {
+namespace detail {
+
+/*
+ * recvmmsg/sendmmsg staging for one udp socket. Reads fill a ring of
+ * preallocated slots with a single syscall and hand them out one by one the
+ * way c-ares asks for them; sends are copied aside and leave together on
+ * Flush(). Only ever used from the channel's strand.
+ */
+class DatagramBatch {
+public:
+    static constexpr unsigned kSlots = 16;
+    static constexpr size_t kReadSize = 4097; /* what c-ares reads an answer into */
+    static constexpr size_t kSendSize = 512;  /* plenty for one query, larger ones go out directly */
+
+    DatagramBatch() {
+        for (unsigned i = 0; i < kSlots; ++i) {
+            read_iov_[i].iov_base = read_buf_[i].data();
+            read_iov_[i].iov_len = kReadSize;
+            send_iov_[i].iov_base = send_buf_[i].data();
+        }
+    }
+
+    DatagramBatch(const DatagramBatch &) = delete;
+    DatagramBatch &operator=(const DatagramBatch &) = delete;
+
+    /* same contract as recvfrom on a non-blocking socket */
+    ares_ssize_t Read(int fd, void *data, size_t data_len, struct sockaddr *addr, ares_socklen_t *addr_len) {
+        if (next_ == received_) {
+            /*
+             * a short batch already drained the socket, report that instead of
+             * asking the kernel again. c-ares reads until it sees EAGAIN, so
+             * this ends exactly the read loop that started the batch.
+             */
+            if (drained_) {
+                drained_ = false;
+                errno = EAGAIN;
+                return -1;
+            }
+            for (unsigned i = 0; i < kSlots; ++i) {
+                auto &hdr = read_msgs_[i].msg_hdr;
+                memset(&hdr, 0, sizeof hdr);
+                hdr.msg_name = &read_from_[i];
+                hdr.msg_namelen = sizeof read_from_[i];
+                hdr.msg_iov = &read_iov_[i];
+                hdr.msg_iovlen = 1;
+            }
+            int count = ::recvmmsg(fd, read_msgs_.data(), kSlots, MSG_DONTWAIT, nullptr);
+            if (count <= 0) {
+                return -1;
+            }
+            next_ = 0;
+            received_ = static_cast<unsigned>(count);
+            drained_ = (received_ < kSlots);
+        }
+
+        auto &msg = read_msgs_[next_];
+        auto &from = read_from_[next_];
+        auto length = std::min<size_t>(msg.msg_len, data_len);
+        memcpy(data, read_buf_[next_].data(), length);
+        if (addr) {
+            auto from_len = std::min<ares_socklen_t>(msg.msg_hdr.msg_namelen, *addr_len);
+            memcpy(addr, &from, from_len);
+            *addr_len = from_len;
+        }
+        ++next_;
+        return static_cast<ares_ssize_t>(length);
+    }
+
+    /* false if the datagram has to be sent right away */
+    bool Queue(const struct iovec *data, int len, ares_ssize_t &result) {
+        size_t total = 0;
+        for (int i = 0; i < len; ++i) {
+            total += data[i].iov_len;
+        }
+        if (queued_ == kSlots || total > kSendSize) {
+            return false;
+        }
+        auto *dst = send_buf_[queued_].data();
+        for (int i = 0; i < len; ++i) {
+            memcpy(dst, data[i].iov_base, data[i].iov_len);
+            dst += data[i].iov_len;
+        }
+        send_iov_[queued_].iov_len = total;
+        ++queued_;
+        result = static_cast<ares_ssize_t>(total);
+        return true;
+    }
+
+    bool IsFull() const {
+        return queued_ == kSlots;
+    }
+
+    bool HasQueued() const {
+        return queued_ != 0;
+    }
+
+    /*
+     * Whatever the kernel refuses is dropped, to c-ares that looks like a
+     * lost datagram and the query times out and retries as usual.
+     */
+    void Flush(int fd) {
+        unsigned sent = 0;
+        while (sent < queued_) {
+            for (unsigned i = sent; i < queued_; ++i) {
+                auto &hdr = send_msgs_[i].msg_hdr;
+                memset(&hdr, 0, sizeof hdr);
+                hdr.msg_iov = &send_iov_[i];
+                hdr.msg_iovlen = 1;
+            }
+            int count = ::sendmmsg(fd, send_msgs_.data() + sent, queued_ - sent, MSG_DONTWAIT);
+            if (count <= 0) {
+                break;
+            }
+            sent += static_cast<unsigned>(count);
+        }
+        queued_ = 0;
+    }
+
+private:
+    std::array<struct mmsghdr, kSlots> read_msgs_;
+    std::array<struct iovec, kSlots> read_iov_;
+    std::array<struct sockaddr_storage, kSlots> read_from_;
+    std::array<std::array<unsigned char, kReadSize>, kSlots> read_buf_;
+    unsigned next_ = 0;
+    unsigned received_ = 0;
+    bool drained_ = false;
+
+    std::array<struct mmsghdr, kSlots> send_msgs_;
+    std::array<struct iovec, kSlots> send_iov_;
+    std::array<std::array<unsigned char, kSendSize>, kSlots> send_buf_;
+    unsigned queued_ = 0;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // defined(__linux__)
+
+#endif // __CARES_SERVICES_DATAGRAM_BATCH_HXX__
@@ -1,56 +1,69 @@
 #ifndef __CARES_SERVICES_EPSEQ_HXX__
 #define __CARES_SERVICES_EPSEQ_HXX__
 
-#include <list>
-#include <memory>
+#include <chrono>
+#include <limits>
+#include <algorithm>
 #include <ares.h>
 #include <boost/asio.hpp>
+#include <boost/container/small_vector.hpp>
 
 namespace cares {
 namespace detail {
 
+/* most answers carry a handful of addresses, keep those inline */
+static constexpr size_t kInlineEndpoints = 4;
+
 template<class Protocol>
 class EndpointSequence {
     using address = boost::asio::ip::address;
 public:
     using endpoint = boost::asio::ip::basic_endpoint<Protocol>;
-    using sequence = std::list<endpoint>;
+    using sequence = boost::container::small_vector<endpoint, kInlineEndpoints>;
     using iterator = typename sequence::iterator;
     using const_iterator = typename sequence::const_iterator;
 
     explicit EndpointSequence(uint16_t port)
-        : endpoints_(std::make_shared<sequence>()), last_family_(AF_UNSPEC), port_(port) {
+        : last_family_(AF_UNSPEC), port_(port),
+          ttl_(std::numeric_limits<int>::max()) {
     }
 
-    EndpointSequence(const struct hostent *entries, uint16_t port)
+    EndpointSequence(const struct ares_addrinfo *entries, uint16_t port)
         : EndpointSequence(port) {
         Append(entries);
     }
 
     EndpointSequence(const EndpointSequence &) = default;
+    EndpointSequence(EndpointSequence &&) = default;
+    EndpointSequence &operator=(const EndpointSequence &) = default;
+    EndpointSequence &operator=(EndpointSequence &&) = default;
 
     ~EndpointSequence() = default;
 
-    void Append(const struct hostent *entries) {
-        sequence subseq;
-        BuildList(entries, subseq);
-        if (!subseq.empty()) {
-            last_family_ = entries->h_addrtype;
-            endpoints_->splice(endpoints_->end(), subseq);
+    void Append(const struct ares_addrinfo *entries) {
+        if (AppendNodes(entries) != 0) {
+            last_family_ = entries->nodes->ai_family;
         }
     }
 
     void Append(boost::asio::ip::address address) {
         last_family_ = (address.is_v4() ? AF_INET : AF_INET6);
-        endpoints_->emplace_back(std::move(address), port_);
+        endpoints_.emplace_back(std::move(address), port_);
+    }
+
+    void Append(const EndpointSequence &other) {
+        if (!other.IsEmpty()) {
+            endpoints_.insert(endpoints_.end(), other.begin(), other.end());
+            last_family_ = other.last_family_;
+            ttl_ = std::min(ttl_, other.ttl_);
+        }
     }
 
-    void Prepend(const struct hostent *entries) {
-        sequence subseq;
-        BuildList(entries, subseq);
-        if (!subseq.empty()) {
-            last_family_ = entries->h_addrtype;
-            endpoints_->splice(endpoints_->begin(), subseq);
+    void Prepend(const struct ares_addrinfo *entries) {
+        auto appended = AppendNodes(entries);
+        if (appended != 0) {
+            last_family_ = entries->nodes->ai_family;
+            std::rotate(endpoints_.begin(), endpoints_.end() - appended, endpoints_.end());
         }
     }
 
@@ -62,57 +75,76 @@ public:
         return true;
     }
 
+    /* smallest ttl among the records (and cnames) merged so far */
+    std::chrono::seconds Ttl() const {
+        return std::chrono::seconds{ttl_};
+    }
+
     bool IsEmpty() const {
-        return endpoints_->empty();
+        return endpoints_.empty();
     }
 
     iterator begin() {
-        return endpoints_->begin();
+        return endpoints_.begin();
     }
 
     const_iterator begin() const {
-        return endpoints_->begin();
+        return endpoints_.begin();
     }
 
     iterator end() {
-        return endpoints_->end();
+        return endpoints_.end();
     }
 
     const_iterator end() const {
-        return endpoints_->end();
+        return endpoints_.end();
     }
 
     bool empty() const {
         return IsEmpty();
     }
 
+    size_t size() const {
+        return endpoints_.size();
+    }
+
 private:
-    void BuildList(const struct hostent *entries, sequence &subseq) {
+    size_t AppendNodes(const struct ares_addrinfo *entries) {
         address addr;
-        subseq.clear();
-        for (char **p = entries->h_addr_list; *p; ++p) {
-            if (entries->h_addrtype == AF_INET) {
+        size_t appended = 0;
+        for (auto *node = entries->nodes; node; node = node->ai_next) {
+            if (node->ai_family == AF_INET) {
                 boost::asio::ip::address_v4::bytes_type bytes;
-                assert(bytes.size() == entries->h_length);
-                memcpy(bytes.data(), *p, bytes.size());
+                auto sin = reinterpret_cast<const struct sockaddr_in *>(node->ai_addr);
+                memcpy(bytes.data(), &sin->sin_addr, bytes.size());
                 addr = boost::asio::ip::make_address_v4(bytes);
-            } else {
+            } else if (node->ai_family == AF_INET6) {
                 boost::asio::ip::address_v6::bytes_type bytes;
-                assert(bytes.size() == entries->h_length);
-                memcpy(bytes.data(), *p, bytes.size());
-                addr = boost::asio::ip::make_address_v6(bytes);
+                auto sin6 = reinterpret_cast<const struct sockaddr_in6 *>(node->ai_addr);
+                memcpy(bytes.data(), &sin6->sin6_addr, bytes.size());
+                addr = boost::asio::ip::make_address_v6(bytes, sin6->sin6_scope_id);
+            } else {
+                continue;
             }
-            subseq.emplace_back(std::move(addr), port_);
+            ttl_ = std::min(ttl_, node->ai_ttl);
+            endpoints_.emplace_back(std::move(addr), port_);
+            ++appended;
         }
+        if (appended != 0) {
+            for (auto *cname = entries->cnames; cname; cname = cname->next) {
+                ttl_ = std::min(ttl_, cname->ttl);
+            }
+        }
+        return appended;
     }
 
-    std::shared_ptr<sequence> endpoints_;
+    sequence endpoints_;
     int last_family_;
     uint16_t port_;
+    int ttl_;
 };
 
 }; // namespace detail
 }; // namespace cares
 
 #endif // __CARES_SERVICES_EPSEQ_HXX__
-
@@ -9,27 +9,6 @@
 namespace cares {
 namespace error {
 
-namespace detail {
-
-class CaresErrorCategory : public boost::system::error_category {
-public:
-    const char *name() const noexcept {
-        return "cares error";
-    }
-
-    std::string message(int ev) const {
-        return ::ares_strerror(ev);
-    }
-};
-
-} // namespace detail
-
-inline boost::system::error_category &get_category() {
-    static auto category = \
-        std::make_unique<detail::CaresErrorCategory>();
-    return *category;
-}
-
 enum basic_errors {
     no_data = ARES_ENODATA,
     malformat = ARES_EFORMERR,
@@ -54,9 +33,35 @@ enum basic_errors {
     not_initialized = ARES_ENOTINITIALIZED,
     iphlpapi_failed = ARES_ELOADIPHLPAPI,
     get_network_params_failed = ARES_EADDRGETNETWORKPARAMS,
-    operation_cancelled = ARES_ECANCELLED
+    operation_cancelled = ARES_ECANCELLED,
+    /* not from c-ares: admission control turned the lookup away */
+    overloaded = 100
 };
 
+namespace detail {
+
+class CaresErrorCategory : public boost::system::error_category {
+public:
+    const char *name() const noexcept {
+        return "cares error";
+    }
+
+    std::string message(int ev) const {
+        if (ev == overloaded) {
+            return "Too many lookups in flight";
+        }
+        return ::ares_strerror(ev);
+    }
+};
+
+} // namespace detail
+
+inline boost::system::error_category &get_category() {
+    static auto category = \
+        std::make_unique<detail::CaresErrorCategory>();
+    return *category;
+}
+
 } // namespace error
 } // namespace cares
 
@@ -0,0 +1,237 @@
+#ifndef __CARES_SERVICES_HEALTH_HXX__
+#define __CARES_SERVICES_HEALTH_HXX__
+
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include <boost/asio.hpp>
+
+#include "servers.hxx"
+
+namespace cares {
+namespace detail {
+
+/*
+ * What a channel knows about each of its servers: smoothed rtt from udp
+ * answers and a streak of failures (nothing back in time, or refused).
+ * Healthy servers are tried fastest first, failing ones go last and get a
+ * probe after a backoff that doubles per failure; servers that see no
+ * traffic are probed now and then to keep their rtt current. The rtt
+ * variance gives each server a retransmission timeout as in RFC 6298. Only
+ * used on the channel's strand.
+ */
+class ServerHealth {
+public:
+    using clock_type = std::chrono::steady_clock;
+
+    static constexpr uint32_t kFailureThreshold = 2;
+
+    /* servers that stay configured keep what is known about them */
+    void SetServers(const ServerList &servers) {
+        std::vector<State> states;
+        auto now = clock_type::now();
+        for (auto &server : servers) {
+            auto itr = Find(server.address, server.port);
+            if (itr != states_.end()) {
+                states.push_back(*itr);
+            } else {
+                states.push_back(State{server, clock_type::duration::zero(), clock_type::duration::zero(), false, 0, now, false});
+            }
+        }
+        states_ = std::move(states);
+    }
+
+    bool IsEmpty() const {
+        return states_.empty();
+    }
+
+    /*
+     * Smoothed like tcp's srtt and rttvar, any answer also ends a failure
+     * streak. A negative rtt is an answer to a resend, which only does that.
+     */
+    void OnAnswer(const boost::asio::ip::address &address, uint16_t port, clock_type::duration rtt) {
+        auto itr = Find(address, port);
+        if (itr == states_.end()) {
+            return;
+        }
+        itr->failures = 0;
+        if (rtt < clock_type::duration::zero()) {
+            return;
+        }
+        if (itr->sampled) {
+            auto delta = (itr->srtt > rtt) ? itr->srtt - rtt : rtt - itr->srtt;
+            itr->rttvar = (itr->rttvar * 3 + delta) / 4;
+            itr->srtt = (itr->srtt * 7 + rtt) / 8;
+        } else {
+            itr->srtt = rtt;
+            itr->rttvar = rtt / 2;
+        }
+        itr->sampled = true;
+    }
+
+    /*
+     * Per try timeout and try count for a query that goes to first: its rto,
+     * never below 50ms, and as many tries as fit in budget with c-ares
+     * doubling the timeout each round, at most four. A server that never
+     * answered starts at 1s like RFC 6298 does.
+     */
+    void RetrySchedule(const ServerAddress &first, clock_type::duration budget, clock_type::duration &timeout, int &tries) const {
+        clock_type::duration rto = std::chrono::seconds{1};
+        auto itr = Find(first.address, first.port);
+        if (itr != states_.end() && itr->sampled) {
+            rto = std::max<clock_type::duration>(itr->srtt + itr->rttvar * 4, std::chrono::milliseconds{50});
+        }
+        timeout = std::min(budget, rto);
+        tries = 1;
+        auto spent = timeout;
+        while (tries < 4 && spent + timeout * (1 << tries) <= budget) {
+            spent += timeout * (1 << tries);
+            ++tries;
+        }
+    }
+
+    /* refused is as good as proof, a lost answer needs a second one */
+    void OnFailure(const boost::asio::ip::address &address, uint16_t port, bool refused) {
+        auto itr = Find(address, port);
+        if (itr == states_.end()) {
+            return;
+        }
+        itr->failures = refused ? std::max(itr->failures + 1, uint32_t{kFailureThreshold}) : itr->failures + 1;
+        if (itr->failures >= kFailureThreshold) {
+            auto shift = std::min<uint32_t>(itr->failures - kFailureThreshold, 6);
+            itr->next_probe = clock_type::now() + std::chrono::seconds{1} * (1 << shift);
+        }
+    }
+
+    /*
+     * The order servers should be tried in, true when it differs enough from
+     * current to be worth a switch: a failing server is ahead of a healthy
+     * one, or the new first server is clearly faster than the old one.
+     */
+    bool Reorder(const ServerList &current, ServerList &order) const {
+        std::vector<const State *> ranked;
+        for (auto &server : current) {
+            auto itr = Find(server.address, server.port);
+            if (itr == states_.end()) {
+                return false;
+            }
+            ranked.push_back(&*itr);
+        }
+        std::stable_sort(ranked.begin(), ranked.end(), [](const State *lhs, const State *rhs) {
+            if (lhs->IsFailing() != rhs->IsFailing()) {
+                return !lhs->IsFailing();
+            }
+            if (lhs->sampled != rhs->sampled) {
+                return lhs->sampled;
+            }
+            return lhs->sampled && lhs->srtt < rhs->srtt;
+        });
+
+        order.clear();
+        for (auto *state : ranked) {
+            order.push_back(state->server);
+        }
+        if (order == current) {
+            return false;
+        }
+        /* a failing server ahead of a healthy one */
+        bool failing = false;
+        for (auto &server : current) {
+            auto &state = *Find(server.address, server.port);
+            if (failing && !state.IsFailing()) {
+                return true;
+            }
+            failing = failing || state.IsFailing();
+        }
+        auto &first = *Find(current.front().address, current.front().port);
+        auto &best = *ranked.front();
+        /* a quarter faster, otherwise measurements jitter us back and forth */
+        return first.sampled && best.sampled && best.srtt * 5 < first.srtt * 4;
+    }
+
+    /* servers other than the first one due for a probe, marked as being probed */
+    ServerList TakeProbes(const ServerList &current) {
+        ServerList probes;
+        auto now = clock_type::now();
+        for (size_t i = 1; i < current.size(); ++i) {
+            auto itr = Find(current[i].address, current[i].port);
+            if (itr == states_.end() || itr->probing || now < itr->next_probe) {
+                continue;
+            }
+            itr->probing = true;
+            probes.push_back(itr->server);
+        }
+        /* a failing first server can only recover through a probe */
+        if (!current.empty()) {
+            auto itr = Find(current.front().address, current.front().port);
+            if (itr != states_.end() && itr->IsFailing() && !itr->probing && now >= itr->next_probe) {
+                itr->probing = true;
+                probes.push_back(itr->server);
+            }
+        }
+        return probes;
+    }
+
+    void OnProbeDone(const ServerAddress &server, bool answered, clock_type::duration rtt) {
+        auto itr = Find(server.address, server.port);
+        if (itr == states_.end()) {
+            return;
+        }
+        itr->probing = false;
+        if (answered) {
+            OnAnswer(server.address, server.port, rtt);
+            itr->next_probe = clock_type::now() + std::chrono::seconds{30};
+        } else {
+            OnFailure(server.address, server.port, false);
+            if (itr->failures < kFailureThreshold) {
+                itr->next_probe = clock_type::now() + std::chrono::seconds{1};
+            }
+        }
+    }
+
+    /* cancelled with the channel, says nothing about the server */
+    void OnProbeCancelled(const ServerAddress &server) {
+        auto itr = Find(server.address, server.port);
+        if (itr != states_.end()) {
+            itr->probing = false;
+        }
+    }
+
+private:
+    struct State {
+        ServerAddress server;
+        clock_type::duration srtt;
+        clock_type::duration rttvar;
+        bool sampled;
+        uint32_t failures;
+        clock_type::time_point next_probe;
+        bool probing;
+
+        bool IsFailing() const {
+            return failures >= kFailureThreshold;
+        }
+    };
+
+    static uint16_t PortOf(uint16_t port) {
+        return port ? port : 53;
+    }
+
+    std::vector<State>::iterator Find(const boost::asio::ip::address &address, uint16_t port) {
+        return std::find_if(states_.begin(), states_.end(), [&](const State &state) {
+            return state.server.address == address && PortOf(state.server.port) == PortOf(port);
+        });
+    }
+
+    std::vector<State>::const_iterator Find(const boost::asio::ip::address &address, uint16_t port) const {
+        return std::find_if(states_.begin(), states_.end(), [&](const State &state) {
+            return state.server.address == address && PortOf(state.server.port) == PortOf(port);
+        });
+    }
+
+    std::vector<State> states_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_HEALTH_HXX__
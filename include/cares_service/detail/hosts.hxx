@@ -0,0 +1,227 @@
+#ifndef __CARES_SERVICES_HOSTS_HXX__
+#define __CARES_SERVICES_HOSTS_HXX__
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cctype>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <unordered_map>
+#include <sys/stat.h>
+#include <boost/asio.hpp>
+
+#include "resolve_mode.hxx"
+
+namespace cares {
+namespace detail {
+
+/*
+ * The hosts file parsed into a hash index, so answering from it costs one
+ * lookup and no file access. The file is checked for changes at most once
+ * per check interval and reloaded when its mtime or size moved; readers keep
+ * using the old index until the new one is swapped in.
+ */
+class HostsTable {
+public:
+    using address_list = std::vector<boost::asio::ip::address>;
+
+    HostsTable(const HostsTable &) = delete;
+    HostsTable()
+        : HostsTable(DefaultPath()) {
+    }
+
+    explicit HostsTable(std::string path, std::chrono::milliseconds check_interval = std::chrono::seconds{1})
+        : path_(std::move(path)), check_interval_(check_interval), index_(std::make_shared<Index>()), next_check_(0) {
+        Reload();
+    }
+
+    static std::string DefaultPath() {
+#if defined(_WIN32)
+        const char *root = std::getenv("SystemRoot");
+        return std::string{root ? root : "C:\\Windows"} + "\\System32\\drivers\\etc\\hosts";
+#else
+        return "/etc/hosts";
+#endif
+    }
+
+    /* addresses in the order mode asks for, false if the name isn't listed for it */
+    bool Lookup(const std::string &name, resolve_mode mode, address_list &addresses) {
+        addresses.clear();
+        AddressAppender appender{addresses};
+        return Lookup(name, mode, appender);
+    }
+
+    /* appends them straight to results, Results::Append(address) like EndpointSequence */
+    template<class Results>
+    bool Lookup(const std::string &name, resolve_mode mode, Results &results) {
+        MaybeReload();
+        auto index = std::atomic_load(&index_);
+        auto itr = index->find(Normalize(name));
+        if (itr == index->end()) {
+            return false;
+        }
+        const address_list *first = &itr->second.v4;
+        const address_list *second = &itr->second.v6;
+        if (mode == ipv6_only || mode == ipv6_first) {
+            std::swap(first, second);
+        }
+        if (mode == ipv4_only || mode == ipv6_only) {
+            second = nullptr;
+        }
+        if (first->empty() && (!second || second->empty())) {
+            return false;
+        }
+        for (auto &address : *first) {
+            results.Append(address);
+        }
+        if (second) {
+            for (auto &address : *second) {
+                results.Append(address);
+            }
+        }
+        return true;
+    }
+
+    /* reads the file now, whatever the check interval says */
+    void Reload() {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(check_interval_);
+        next_check_.store((std::chrono::steady_clock::now() + interval).time_since_epoch().count());
+        Signature signature;
+        Stat(signature);
+        signature_ = signature;
+        /* a missing file just lists nothing */
+        std::atomic_store(&index_, signature.exists ? Parse() : std::make_shared<Index>());
+    }
+
+    size_t Size() const {
+        return std::atomic_load(&index_)->size();
+    }
+
+    const std::string &GetPath() const {
+        return path_;
+    }
+
+private:
+    struct AddressAppender {
+        address_list &addresses;
+
+        void Append(const boost::asio::ip::address &address) {
+            addresses.push_back(address);
+        }
+    };
+
+    struct Addresses {
+        address_list v4;
+        address_list v6;
+    };
+
+    using Index = std::unordered_map<std::string, Addresses>;
+
+    struct Signature {
+        bool exists = false;
+        int64_t mtime = 0;
+        int64_t size = 0;
+
+        bool operator==(const Signature &other) const {
+            return exists == other.exists && mtime == other.mtime && size == other.size;
+        }
+    };
+
+    static std::string Normalize(std::string name) {
+        if (!name.empty() && name.back() == '.') {
+            name.pop_back();
+        }
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return std::tolower(c); });
+        return name;
+    }
+
+    void MaybeReload() {
+        auto now = std::chrono::steady_clock::now().time_since_epoch().count();
+        auto next = next_check_.load(std::memory_order_relaxed);
+        if (now < next) {
+            return;
+        }
+        /* one caller does the check, the others go on with the current index */
+        auto interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(check_interval_).count();
+        if (!next_check_.compare_exchange_strong(next, now + interval)) {
+            return;
+        }
+        Signature signature;
+        Stat(signature);
+        {
+            std::lock_guard<std::mutex> lock{mutex_};
+            if (signature == signature_) {
+                return;
+            }
+        }
+        Reload();
+    }
+
+    bool Stat(Signature &signature) const {
+#if defined(_WIN32)
+        struct _stat64 st;
+        if (::_stat64(path_.c_str(), &st) != 0) {
+            return false;
+        }
+#else
+        struct stat st;
+        if (::stat(path_.c_str(), &st) != 0) {
+            return false;
+        }
+#endif
+        signature.exists = true;
+        signature.mtime = static_cast<int64_t>(st.st_mtime);
+        signature.size = static_cast<int64_t>(st.st_size);
+        return true;
+    }
+
+    std::shared_ptr<Index> Parse() const {
+        auto index = std::make_shared<Index>();
+        std::ifstream file{path_};
+        std::string line;
+        while (std::getline(file, line)) {
+            auto comment = line.find('#');
+            if (comment != std::string::npos) {
+                line.erase(comment);
+            }
+            std::istringstream fields{line};
+            std::string token;
+            if (!(fields >> token)) {
+                continue;
+            }
+            boost::system::error_code ec;
+            auto address = boost::asio::ip::make_address(token, ec);
+            if (ec) {
+                continue;
+            }
+            while (fields >> token) {
+                auto &entry = (*index)[Normalize(token)];
+                auto &list = address.is_v4() ? entry.v4 : entry.v6;
+                if (std::find(list.begin(), list.end(), address) == list.end()) {
+                    list.push_back(address);
+                }
+            }
+        }
+        return index;
+    }
+
+    std::string path_;
+    std::chrono::milliseconds check_interval_;
+    std::mutex mutex_; /* serializes reloads */
+    Signature signature_;
+    std::shared_ptr<Index> index_;
+    std::atomic<std::chrono::steady_clock::rep> next_check_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_HOSTS_HXX__
@@ -1,8 +1,12 @@
 #ifndef __CARES_SERVICES_IO_OBJECT_HXX__
 #define __CARES_SERVICES_IO_OBJECT_HXX__
 
+#include <chrono>
 #include <boost/asio.hpp>
 
+#include "record.hxx"
+#include "request.hxx"
+
 namespace cares {
 namespace detail {
 
@@ -10,16 +14,107 @@ template<class Service>
 class basic_cares_resolver : public boost::asio::basic_io_object<Service> {
 public:
     using results_type = typename Service::results_type;
+    using batch_results_type = typename Service::batch_results_type;
+    template<class Record>
+    using records_type = typename Service::template records_type<Record>;
+    using srv_results_type = typename Service::srv_results_type;
     using native_handle_type = typename Service::native_handle_type;
     using resolve_mode_type = typename Service::resolve_mode_type;
+    using cache_type = typename Service::cache_type;
+    using hosts_type = typename Service::hosts_type;
+    using stats_type = typename Service::stats_type;
 
     explicit basic_cares_resolver(boost::asio::io_context &context)
         : boost::asio::basic_io_object<Service>(context) {
     }
 
+    /*
+     * Takes any completion token, plain handlers as well as use_future or
+     * use_awaitable, with the signature void(error_code, results_type).
+     */
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, results_type))
+    async_resolve(const std::string &name, uint16_t port, CompletionToken &&token) {
+        return initiate_resolve(name, port, std::chrono::steady_clock::duration::zero(), nullptr, std::forward<CompletionToken>(token));
+    }
+
+    /* completes with error::timeout if no answer arrived within deadline */
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, results_type))
+    async_resolve(const std::string &name, uint16_t port, std::chrono::steady_clock::duration deadline, CompletionToken &&token) {
+        return initiate_resolve(name, port, deadline, nullptr, std::forward<CompletionToken>(token));
+    }
+
+    /* handle.cancel() aborts just this request with error::operation_cancelled */
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, results_type))
+    async_resolve(const std::string &name, uint16_t port, RequestHandle &handle, CompletionToken &&token) {
+        return initiate_resolve(name, port, std::chrono::steady_clock::duration::zero(), &handle, std::forward<CompletionToken>(token));
+    }
+
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, results_type))
+    async_resolve(const std::string &name, uint16_t port, std::chrono::steady_clock::duration deadline, RequestHandle &handle, CompletionToken &&token) {
+        return initiate_resolve(name, port, deadline, &handle, std::forward<CompletionToken>(token));
+    }
+
+    /* cb(ec, results, more) fires once per address family while more is true */
     template<class Handler>
-    void async_resolve(const std::string &name, uint16_t port, Handler cb) {
-        this->get_service().async_resolve(this->get_implementation(), name, port, std::move(cb));
+    void async_resolve_stream(const std::string &name, uint16_t port, Handler cb) {
+        this->get_service().async_resolve_stream(this->get_implementation(), name, port, std::move(cb));
+    }
+
+    /* completes with void(error_code, batch_results_type), any completion token works */
+    template<class Names, class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, batch_results_type))
+    async_resolve_batch(const Names &names, uint16_t port, CompletionToken &&token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, batch_results_type)>(
+            [this](auto &&handler, const Names &names, uint16_t port) {
+                this->get_service().async_resolve_batch(this->get_implementation(), names, port, std::forward<decltype(handler)>(handler));
+            },
+            token, std::cref(names), port
+        );
+    }
+
+    /*
+     * Records of one type, e.g. async_query<cares::srv>, completing with
+     * void(error_code, records_type<Record>). Names and texts are views
+     * into the answer that live as long as any copy of the records.
+     * query_scope::search tries the search domains too, exact only name.
+     */
+    template<class Record, class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, records_type<Record>))
+    async_query(const std::string &name, query_scope scope, CompletionToken &&token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, records_type<Record>)>(
+            [this](auto &&handler, const std::string &name, query_scope scope) {
+                this->get_service().template async_query<Record>(this->get_implementation(), name, scope, std::forward<decltype(handler)>(handler));
+            },
+            token, name, scope
+        );
+    }
+
+    /* the PTR records of address, the arpa name is asked for as is */
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, records_type<PtrRecord>))
+    async_reverse(const boost::asio::ip::address &address, CompletionToken &&token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, records_type<PtrRecord>)>(
+            [this](auto &&handler, const boost::asio::ip::address &address) {
+                this->get_service().async_reverse(this->get_implementation(), address, std::forward<decltype(handler)>(handler));
+            },
+            token, address
+        );
+    }
+
+    /* SRV records of name with their targets resolved, void(error_code, srv_results_type) */
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, srv_results_type))
+    async_resolve_srv(const std::string &name, CompletionToken &&token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, srv_results_type)>(
+            [this](auto &&handler, const std::string &name) {
+                this->get_service().async_resolve_srv(this->get_implementation(), name, std::forward<decltype(handler)>(handler));
+            },
+            token, name
+        );
     }
 
     void cancel() {
@@ -42,10 +137,129 @@ public:
         this->get_service().resolve_mode(this->get_implementation(), mode, ec);
     }
 
+    std::chrono::milliseconds resolution_delay() {
+        return this->get_service().resolution_delay(this->get_implementation());
+    }
+
+    void resolution_delay(std::chrono::milliseconds delay) {
+        this->get_service().resolution_delay(this->get_implementation(), delay);
+    }
+
+    bool coalesce_readiness() {
+        return this->get_service().coalesce_readiness(this->get_implementation());
+    }
+
+    void coalesce_readiness(bool enable) {
+        this->get_service().coalesce_readiness(this->get_implementation(), enable);
+    }
+
+    bool batch_datagrams() {
+        return this->get_service().batch_datagrams(this->get_implementation());
+    }
+
+    void batch_datagrams(bool enable) {
+        this->get_service().batch_datagrams(this->get_implementation(), enable);
+    }
+
+    /* fastest healthy server first, failing ones last until a probe answers */
+    bool adaptive_servers() {
+        return this->get_service().adaptive_servers(this->get_implementation());
+    }
+
+    void adaptive_servers(bool enable) {
+        this->get_service().adaptive_servers(this->get_implementation(), enable);
+    }
+
+    /* retry after the server's rto, the timeout becomes the budget for every try */
+    bool adaptive_timeout() {
+        return this->get_service().adaptive_timeout(this->get_implementation());
+    }
+
+    void adaptive_timeout(bool enable) {
+        this->get_service().adaptive_timeout(this->get_implementation(), enable);
+    }
+
+    /* ares queries at once, 0 for no limit; past it lookups wait or fail with error::overloaded */
+    size_t max_in_flight() {
+        return this->get_service().max_in_flight(this->get_implementation());
+    }
+
+    void max_in_flight(size_t limit) {
+        this->get_service().max_in_flight(this->get_implementation(), limit);
+    }
+
+    /* lookups that may wait for a slot in FIFO order, 0 rejects as soon as all slots are taken */
+    size_t max_waiting() {
+        return this->get_service().max_waiting(this->get_implementation());
+    }
+
+    void max_waiting(size_t limit) {
+        this->get_service().max_waiting(this->get_implementation(), limit);
+    }
+
+    /*
+     * resolv.conf read again into the running channels: servers (unless
+     * set_servers chose them), search domains and ndots. In-flight lookups
+     * finish against the old config, the cache and server health stay.
+     */
+    void reload_config() {
+        this->get_service().reload_config(this->get_implementation());
+    }
+
+    /* reload whenever path changes, checked every interval; zero stops, until then the context never runs out of work */
+    std::chrono::milliseconds watch_config() {
+        return this->get_service().watch_config(this->get_implementation());
+    }
+
+    void watch_config(std::chrono::milliseconds interval, const std::string &path = "/etc/resolv.conf") {
+        this->get_service().watch_config(this->get_implementation(), interval, path);
+    }
+
+    std::shared_ptr<cache_type> cache() {
+        return this->get_service().cache(this->get_implementation());
+    }
+
+    void cache(std::shared_ptr<cache_type> cache) {
+        this->get_service().cache(this->get_implementation(), std::move(cache));
+    }
+
+    std::shared_ptr<hosts_type> hosts() {
+        return this->get_service().hosts(this->get_implementation());
+    }
+
+    /* names listed there are answered without a query, nullptr turns it off */
+    void hosts(std::shared_ptr<hosts_type> hosts) {
+        this->get_service().hosts(this->get_implementation(), std::move(hosts));
+    }
+
+    /* a consistent-enough copy of the counters, take two and diff them for rates */
+    stats_type stats() {
+        return this->get_service().stats(this->get_implementation());
+    }
+
     native_handle_type native_handle() {
         return this->get_service().native_handle(this->get_implementation());
     }
 
+    void set_contexts(const std::vector<boost::asio::io_context *> &contexts) {
+        this->get_service().set_contexts(this->get_implementation(), contexts);
+    }
+
+private:
+    template<class CompletionToken>
+    BOOST_ASIO_INITFN_RESULT_TYPE(CompletionToken, void(boost::system::error_code, results_type))
+    initiate_resolve(const std::string &name, uint16_t port, std::chrono::steady_clock::duration deadline, RequestHandle *handle, CompletionToken &&token) {
+        return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, results_type)>(
+            [this](auto &&handler, const std::string &name, uint16_t port, std::chrono::steady_clock::duration deadline, RequestHandle *handle) {
+                if (deadline.count() == 0 && !handle) {
+                    this->get_service().async_resolve(this->get_implementation(), name, port, std::forward<decltype(handler)>(handler));
+                } else {
+                    this->get_service().async_resolve(this->get_implementation(), name, port, deadline, handle, std::forward<decltype(handler)>(handler));
+                }
+            },
+            token, name, port, deadline, handle
+        );
+    }
 };
 
 } // namespace detail
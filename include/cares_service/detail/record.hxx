@@ -0,0 +1,476 @@
+#ifndef __CARES_SERVICES_RECORD_HXX__
+#define __CARES_SERVICES_RECORD_HXX__
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <limits>
+#include <memory>
+#include <random>
+#include <iterator>
+#include <algorithm>
+#include <ares.h>
+#include <boost/asio.hpp>
+#include <boost/utility/string_view.hpp>
+
+#include "error.hxx"
+
+namespace cares {
+namespace detail {
+
+/* search walks the search domains like a host lookup does, exact asks for the name as given */
+enum class query_scope {
+    search,
+    exact,
+};
+
+/*
+ * Reads the wire format of one answer message. Names are written out
+ * dotted (no trailing dot, "" for the root) through a NameSink, see
+ * RecordSet for the two passes that go through it.
+ */
+class AnswerReader {
+public:
+    AnswerReader(const unsigned char *message, size_t length)
+        : message_(message), length_(length) {
+    }
+
+    bool Read16(size_t &offset, uint16_t &value) const {
+        if (offset + 2 > length_) {
+            return false;
+        }
+        value = static_cast<uint16_t>((message_[offset] << 8) | message_[offset + 1]);
+        offset += 2;
+        return true;
+    }
+
+    bool Read32(size_t &offset, uint32_t &value) const {
+        uint16_t high, low;
+        if (!Read16(offset, high) || !Read16(offset, low)) {
+            return false;
+        }
+        value = (static_cast<uint32_t>(high) << 16) | low;
+        return true;
+    }
+
+    /* past the name at offset, without following compression pointers */
+    bool SkipName(size_t &offset) const {
+        while (offset < length_) {
+            auto label = message_[offset];
+            if ((label & 0xc0) == 0xc0) {
+                offset += 2;
+                return offset <= length_;
+            }
+            offset += 1 + label;
+            if (label == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /* the name at offset into sink, pointer loops end after a message worth of hops */
+    template<class NameSink>
+    bool ExpandName(size_t offset, NameSink &sink) const {
+        size_t hops = 0;
+        bool first = true;
+        while (offset < length_) {
+            auto label = message_[offset];
+            if ((label & 0xc0) == 0xc0) {
+                if (offset + 2 > length_ || ++hops > length_) {
+                    return false;
+                }
+                offset = ((label & 0x3f) << 8) | message_[offset + 1];
+                continue;
+            }
+            if (label == 0) {
+                return true;
+            }
+            if ((label & 0xc0) != 0 || offset + 1 + label > length_) {
+                return false;
+            }
+            if (!first) {
+                sink.Append(".", 1);
+            }
+            sink.Append(reinterpret_cast<const char *>(message_) + offset + 1, label);
+            first = false;
+            offset += 1 + label;
+        }
+        return false;
+    }
+
+    bool Contains(size_t offset) const {
+        return offset <= length_;
+    }
+
+    boost::string_view Bytes(size_t offset, size_t length) const {
+        return boost::string_view{reinterpret_cast<const char *>(message_) + offset, length};
+    }
+
+private:
+    const unsigned char *message_;
+    size_t length_;
+};
+
+/*
+ * The text the records of a set point into. The first pass only sizes it so
+ * the second one can write without the buffer ever moving.
+ */
+class RecordBuffer {
+public:
+    explicit RecordBuffer(std::string *buffer)
+        : buffer_(buffer), size_(0) {
+    }
+
+    void Append(const char *data, size_t length) {
+        if (buffer_) {
+            buffer_->append(data, length);
+        }
+        size_ += length;
+    }
+
+    /* what was appended since begin, empty in the sizing pass */
+    boost::string_view Since(size_t begin) const {
+        if (!buffer_) {
+            return boost::string_view{};
+        }
+        return boost::string_view{buffer_->data() + begin, size_ - begin};
+    }
+
+    boost::string_view Name(const AnswerReader &reader, size_t offset, bool &ok) {
+        auto begin = size_;
+        ok = reader.ExpandName(offset, *this);
+        return Since(begin);
+    }
+
+    boost::string_view Copy(boost::string_view bytes) {
+        auto begin = size_;
+        Append(bytes.data(), bytes.size());
+        return Since(begin);
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+private:
+    std::string *buffer_;
+    size_t size_;
+};
+
+/* RFC 2782, target "" means the service is not available at name */
+struct SrvRecord {
+    static constexpr uint16_t kType = 33; /* T_SRV */
+
+    uint16_t priority;
+    uint16_t weight;
+    uint16_t port;
+    boost::string_view target;
+    uint32_t ttl;
+
+    static bool Parse(const AnswerReader &reader, size_t offset, size_t, RecordBuffer &buffer, SrvRecord &record) {
+        bool ok;
+        if (!reader.Read16(offset, record.priority) || !reader.Read16(offset, record.weight) || !reader.Read16(offset, record.port)) {
+            return false;
+        }
+        record.target = buffer.Name(reader, offset, ok);
+        return ok;
+    }
+};
+
+struct MxRecord {
+    static constexpr uint16_t kType = 15; /* T_MX */
+
+    uint16_t preference;
+    boost::string_view exchange;
+    uint32_t ttl;
+
+    static bool Parse(const AnswerReader &reader, size_t offset, size_t, RecordBuffer &buffer, MxRecord &record) {
+        bool ok;
+        if (!reader.Read16(offset, record.preference)) {
+            return false;
+        }
+        record.exchange = buffer.Name(reader, offset, ok);
+        return ok;
+    }
+};
+
+struct PtrRecord {
+    static constexpr uint16_t kType = 12; /* T_PTR */
+
+    boost::string_view name;
+    uint32_t ttl;
+
+    static bool Parse(const AnswerReader &reader, size_t offset, size_t, RecordBuffer &buffer, PtrRecord &record) {
+        bool ok;
+        record.name = buffer.Name(reader, offset, ok);
+        return ok;
+    }
+};
+
+/*
+ * The character-strings of a TXT record as on the wire, each behind its
+ * length byte; iterating yields them one by one without copying.
+ */
+struct TxtRecord {
+    static constexpr uint16_t kType = 16; /* T_TXT */
+
+    class const_iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = boost::string_view;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const boost::string_view *;
+        using reference = boost::string_view;
+
+        const_iterator(boost::string_view rest)
+            : rest_(rest) {
+        }
+
+        boost::string_view operator*() const {
+            return rest_.substr(1, static_cast<unsigned char>(rest_[0]));
+        }
+
+        const_iterator &operator++() {
+            rest_.remove_prefix(1 + static_cast<unsigned char>(rest_[0]));
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        bool operator==(const const_iterator &other) const {
+            return rest_.data() == other.rest_.data();
+        }
+
+        bool operator!=(const const_iterator &other) const {
+            return !(*this == other);
+        }
+
+    private:
+        boost::string_view rest_;
+    };
+
+    boost::string_view data;
+    uint32_t ttl;
+
+    const_iterator begin() const {
+        return const_iterator{data};
+    }
+
+    const_iterator end() const {
+        return const_iterator{data.substr(data.size())};
+    }
+
+    static bool Parse(const AnswerReader &reader, size_t offset, size_t length, RecordBuffer &buffer, TxtRecord &record) {
+        auto bytes = reader.Bytes(offset, length);
+        /* every string must end inside the rdata, the iterator relies on it */
+        for (size_t i = 0; i < bytes.size(); i += 1 + static_cast<unsigned char>(bytes[i])) {
+            if (i + 1 + static_cast<unsigned char>(bytes[i]) > bytes.size()) {
+                return false;
+            }
+        }
+        record.data = buffer.Copy(bytes);
+        return true;
+    }
+};
+
+/*
+ * The Record answers of one message. Names and texts are views into a
+ * single buffer shared by all copies of the set, so a set costs two
+ * allocations however many records it has.
+ */
+template<class Record>
+class RecordSet {
+public:
+    using value_type = Record;
+    using sequence = std::vector<Record>;
+    using iterator = typename sequence::iterator;
+    using const_iterator = typename sequence::const_iterator;
+
+    RecordSet() = default;
+
+    /* ARES_ENODATA without a Record among the answers, ARES_EBADRESP when malformed */
+    bool Assign(const unsigned char *message, int length, boost::system::error_code &ec) {
+        records_.clear();
+        buffer_.reset();
+        AnswerReader reader{message, static_cast<size_t>(std::max(length, 0))};
+
+        RecordBuffer sizing{nullptr};
+        sequence records;
+        if (!ParseAnswers(reader, sizing, records)) {
+            ec.assign(ARES_EBADRESP, error::get_category());
+            return false;
+        }
+        if (records.empty()) {
+            ec.assign(ARES_ENODATA, error::get_category());
+            return false;
+        }
+
+        auto text = std::make_shared<std::string>();
+        text->reserve(sizing.Size());
+        RecordBuffer writing{text.get()};
+        records.clear();
+        ParseAnswers(reader, writing, records);
+        records_ = std::move(records);
+        buffer_ = std::move(text);
+        ec.clear();
+        return true;
+    }
+
+    /* smallest ttl of the set */
+    std::chrono::seconds Ttl() const {
+        uint32_t ttl = std::numeric_limits<int32_t>::max();
+        for (auto &record : records_) {
+            ttl = std::min(ttl, record.ttl);
+        }
+        return std::chrono::seconds{ttl};
+    }
+
+    template<class Compare>
+    void Sort(Compare compare) {
+        std::stable_sort(records_.begin(), records_.end(), compare);
+    }
+
+    /* reorder(begin, end) may move the records around as it likes, the views stay valid */
+    template<class Function>
+    void Reorder(Function reorder) {
+        reorder(records_.begin(), records_.end());
+    }
+
+    bool IsEmpty() const {
+        return records_.empty();
+    }
+
+    const_iterator begin() const {
+        return records_.begin();
+    }
+
+    const_iterator end() const {
+        return records_.end();
+    }
+
+    const Record &operator[](size_t index) const {
+        return records_[index];
+    }
+
+    bool empty() const {
+        return IsEmpty();
+    }
+
+    size_t size() const {
+        return records_.size();
+    }
+
+private:
+    static bool ParseAnswers(const AnswerReader &reader, RecordBuffer &buffer, sequence &records) {
+        size_t offset = 4;
+        uint16_t questions, answers;
+        if (!reader.Read16(offset, questions) || !reader.Read16(offset, answers)) {
+            return false;
+        }
+        offset = 12;
+        for (uint16_t i = 0; i < questions; ++i) {
+            if (!reader.SkipName(offset)) {
+                return false;
+            }
+            offset += 4;
+        }
+        for (uint16_t i = 0; i < answers; ++i) {
+            uint16_t type, klass, length;
+            uint32_t ttl;
+            if (!reader.SkipName(offset) || !reader.Read16(offset, type) || !reader.Read16(offset, klass)
+                || !reader.Read32(offset, ttl) || !reader.Read16(offset, length)) {
+                return false;
+            }
+            size_t rdata = offset;
+            offset += length;
+            if (!reader.Contains(offset)) {
+                return false;
+            }
+            /* cnames on the way and other classes are not ours */
+            if (type != Record::kType || klass != 1 /* C_IN */) {
+                continue;
+            }
+            Record record;
+            if (!Record::Parse(reader, rdata, length, buffer, record)) {
+                return false;
+            }
+            record.ttl = std::min<uint32_t>(ttl, std::numeric_limits<int32_t>::max());
+            records.push_back(record);
+        }
+        return true;
+    }
+
+    sequence records_;
+    std::shared_ptr<const std::string> buffer_;
+};
+
+/*
+ * RFC 2782 order: by priority, and within one priority a weighted random
+ * pick after another so every target gets its share of first places. Zero
+ * weights go to the front of each pick, they win only when nothing else does.
+ */
+template<class Iterator, class Engine>
+void OrderSrv(Iterator first, Iterator last, Engine &engine) {
+    std::stable_sort(first, last, [](const SrvRecord &lhs, const SrvRecord &rhs) {
+        return lhs.priority < rhs.priority;
+    });
+    while (first != last) {
+        auto priority = first->priority;
+        auto group_end = std::find_if(first, last, [priority](const SrvRecord &record) {
+            return record.priority != priority;
+        });
+        std::stable_partition(first, group_end, [](const SrvRecord &record) {
+            return record.weight == 0;
+        });
+        for (; first != group_end; ++first) {
+            uint32_t sum = 0;
+            for (auto itr = first; itr != group_end; ++itr) {
+                sum += itr->weight;
+            }
+            auto pick = std::uniform_int_distribution<uint32_t>{0, sum}(engine);
+            auto chosen = first;
+            for (uint32_t running = chosen->weight; running < pick; running += chosen->weight) {
+                ++chosen;
+            }
+            std::rotate(first, chosen, std::next(chosen));
+        }
+    }
+}
+
+/* one engine per thread, srv orders are spread, not secret */
+inline std::minstd_rand &SrvRandom() {
+    thread_local std::minstd_rand engine{std::random_device{}()};
+    return engine;
+}
+
+/* the reverse lookup name of address, in-addr.arpa or nibbles under ip6.arpa */
+inline std::string ReverseName(const boost::asio::ip::address &address) {
+    static const char kHex[] = "0123456789abcdef";
+    std::string name;
+    if (address.is_v4()) {
+        auto bytes = address.to_v4().to_bytes();
+        for (auto itr = bytes.rbegin(); itr != bytes.rend(); ++itr) {
+            name += std::to_string(*itr);
+            name += '.';
+        }
+        return name + "in-addr.arpa";
+    }
+    auto bytes = address.to_v6().to_bytes();
+    for (auto itr = bytes.rbegin(); itr != bytes.rend(); ++itr) {
+        name += kHex[*itr & 0x0f];
+        name += '.';
+        name += kHex[*itr >> 4];
+        name += '.';
+    }
+    return name + "ip6.arpa";
+}
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_RECORD_HXX__
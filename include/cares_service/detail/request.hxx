@@ -0,0 +1,291 @@
+#ifndef __CARES_SERVICES_REQUEST_HXX__
+#define __CARES_SERVICES_REQUEST_HXX__
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <boost/asio.hpp>
+#include <boost/optional.hpp>
+
+#include "error.hxx"
+#include "cache.hxx"
+#include "resolve_mode.hxx"
+
+namespace cares {
+namespace detail {
+
+/*
+ * Shared state of a request, allocated with the handler's associated
+ * allocator or, if it has none, with fallback.
+ */
+template<class T, class Handler, class Allocator, class... Args>
+std::shared_ptr<T> AllocateShared(const Handler &handler, const Allocator &fallback, Args &&...args) {
+    using allocator_type = typename std::allocator_traits<
+        boost::asio::associated_allocator_t<Handler, Allocator>
+    >::template rebind_alloc<T>;
+    return std::allocate_shared<T>(allocator_type(boost::asio::get_associated_allocator(handler, fallback)), std::forward<Args>(args)...);
+}
+
+template<class Handler, class Results>
+struct BoundCompletion {
+    using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+    allocator_type get_allocator() const noexcept {
+        return boost::asio::get_associated_allocator(handler);
+    }
+
+    void operator()() {
+        handler(error, std::move(results));
+    }
+
+    Handler handler;
+    boost::system::error_code error;
+    Results results;
+};
+
+/* runs handler(ec, results) on its associated executor, ios when it has none */
+template<class Handler, class Results>
+void DispatchCompletion(boost::asio::io_context &ios, Handler handler, boost::system::error_code ec, Results results) {
+    auto executor = boost::asio::get_associated_executor(handler, ios.get_executor());
+    boost::asio::dispatch(
+        executor,
+        BoundCompletion<Handler, Results>{std::move(handler), ec, std::move(results)}
+    );
+}
+
+/* keeps the executor the handler completes on busy until it has been handed over */
+template<class Handler>
+using HandlerWork = boost::asio::executor_work_guard<
+    boost::asio::associated_executor_t<Handler, boost::asio::io_context::executor_type>
+>;
+
+template<class Handler>
+HandlerWork<Handler> MakeHandlerWork(const Handler &handler, boost::asio::io_context &ios) {
+    return HandlerWork<Handler>(boost::asio::get_associated_executor(handler, ios.get_executor()));
+}
+
+/*
+ * What a single async_resolve hands to the channel: the user's handler, the
+ * results being filled in and, with a cache, where to store the answer. All
+ * of it lives in one allocation, no type erasure of the handler. With
+ * serve-stale, an upstream failure or the stale answer timeout completes
+ * the request with expired cache data instead.
+ */
+template<class Results, class Handler>
+class ResolveOperation : public std::enable_shared_from_this<ResolveOperation<Results, Handler>> {
+public:
+    using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+    ResolveOperation(boost::asio::io_context &ios, uint16_t port, Handler handler)
+        : context_(ios), work_(MakeHandlerWork(handler, ios)), handler_(std::move(handler)), results_(port), port_(port), mode_(both) {
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return boost::asio::get_associated_allocator(handler_);
+    }
+
+    Results &GetResults() {
+        return results_;
+    }
+
+    void SetCache(std::shared_ptr<ResolveCache> cache, const std::string &name, resolve_mode mode) {
+        cache_ = std::move(cache);
+        name_ = name;
+        mode_ = mode;
+    }
+
+    /* the real answer still fills the cache when it turns up later */
+    void ArmStale(std::chrono::steady_clock::duration timeout) {
+        auto self{this->shared_from_this()};
+        stale_timer_.emplace(context_);
+        stale_timer_->expires_after(timeout);
+        stale_timer_->async_wait(
+            [this, self](boost::system::error_code ec) {
+                Results stale{port_};
+                if (!ec && ServeStale(stale) && TryFire()) {
+                    DispatchCompletion(context_, std::move(handler_), boost::system::error_code{}, std::move(stale));
+                    work_.reset();
+                }
+            }
+        );
+    }
+
+    /* called exactly once, on the completion context */
+    void operator()(boost::system::error_code ec, Results results) {
+        if (cache_) {
+            if (!ec) {
+                cache_->Insert(name_, mode_, results, results.Ttl());
+            } else {
+                cache_->InsertError(name_, mode_, ec);
+            }
+        }
+        if (!TryFire()) {
+            return;
+        }
+        if (stale_timer_) {
+            stale_timer_->cancel();
+        }
+        if (ec && ResolveCache::IsUpstreamFailure(ec)) {
+            Results stale{port_};
+            if (ServeStale(stale)) {
+                ec.clear();
+                results = std::move(stale);
+            }
+        }
+        DispatchCompletion(context_, std::move(handler_), ec, std::move(results));
+        work_.reset();
+    }
+
+private:
+    bool TryFire() {
+        return !fired_.exchange(true);
+    }
+
+    bool ServeStale(Results &results) {
+        ResolveCache::address_list addresses;
+        if (!cache_ || !cache_->LookupStale(name_, mode_, addresses)) {
+            return false;
+        }
+        for (auto &addr : addresses) {
+            results.Append(std::move(addr));
+        }
+        return true;
+    }
+
+    boost::asio::io_context &context_;
+    HandlerWork<Handler> work_;
+    Handler handler_;
+    Results results_;
+    uint16_t port_;
+    std::shared_ptr<ResolveCache> cache_;
+    std::string name_;
+    resolve_mode mode_;
+    boost::optional<boost::asio::steady_timer> stale_timer_;
+    std::atomic<bool> fired_{false};
+};
+
+/*
+ * Completes one request exactly once, whichever comes first: the answer, its
+ * deadline or an explicit cancel. The underlying query is left running, it
+ * may be shared with other lookups of the same name.
+ */
+class RequestGateBase {
+public:
+    virtual ~RequestGateBase() = default;
+
+    virtual void Abort(boost::system::error_code ec) = 0;
+
+protected:
+    bool TryFire() {
+        return !fired_.exchange(true);
+    }
+
+private:
+    std::atomic<bool> fired_{false};
+};
+
+template<class Results, class Handler>
+class RequestGate : public RequestGateBase, public std::enable_shared_from_this<RequestGate<Results, Handler>> {
+public:
+    using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+    RequestGate(boost::asio::io_context &ios, uint16_t port, Handler handler)
+        : context_(ios), timer_(ios), port_(port), work_(MakeHandlerWork(handler, ios)), handler_(std::move(handler)) {
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return boost::asio::get_associated_allocator(handler_);
+    }
+
+    void Arm(std::chrono::steady_clock::duration deadline) {
+        auto self{this->shared_from_this()};
+        timer_.expires_after(deadline);
+        timer_.async_wait(
+            [this, self](boost::system::error_code ec) {
+                if (!ec && TryFire()) {
+                    DispatchCompletion(context_, std::move(handler_), boost::system::error_code{error::timeout, error::get_category()}, Results{port_});
+                    work_.reset();
+                }
+            }
+        );
+        armed_ = true;
+    }
+
+    void Complete(boost::system::error_code ec, Results results) {
+        if (TryFire()) {
+            if (armed_) {
+                timer_.cancel();
+            }
+            DispatchCompletion(context_, std::move(handler_), ec, std::move(results));
+            work_.reset();
+        }
+    }
+
+    void Abort(boost::system::error_code ec) override {
+        if (!TryFire()) {
+            return;
+        }
+        auto self{this->shared_from_this()};
+        boost::asio::post(
+            context_,
+            [this, self, ec]() {
+                if (armed_) {
+                    timer_.cancel();
+                }
+                DispatchCompletion(context_, std::move(handler_), ec, Results{port_});
+                work_.reset();
+            }
+        );
+    }
+
+private:
+    boost::asio::io_context &context_;
+    boost::asio::steady_timer timer_;
+    uint16_t port_;
+    bool armed_ = false;
+    HandlerWork<Handler> work_;
+    Handler handler_;
+};
+
+/* what the channel sees instead of the user's handler */
+template<class Gate>
+struct GateHandler {
+    using allocator_type = typename Gate::allocator_type;
+
+    allocator_type get_allocator() const noexcept {
+        return gate->get_allocator();
+    }
+
+    std::shared_ptr<Gate> gate;
+
+    template<class Results>
+    void operator()(boost::system::error_code ec, Results results) {
+        gate->Complete(ec, std::move(results));
+    }
+};
+
+/*
+ * Handed to async_resolve to abort just that request later on; cancel()
+ * completes its handler with error::operation_cancelled.
+ */
+class RequestHandle {
+public:
+    void cancel() {
+        if (auto gate = gate_.lock()) {
+            gate->Abort(boost::system::error_code{error::operation_cancelled, error::get_category()});
+        }
+    }
+
+    void Attach(std::weak_ptr<RequestGateBase> gate) {
+        gate_ = std::move(gate);
+    }
+
+private:
+    std::weak_ptr<RequestGateBase> gate_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_REQUEST_HXX__
@@ -3,7 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <type_traits>
 #include <boost/preprocessor/seq/enum.hpp>
+#include <boost/preprocessor/seq/size.hpp>
 #include <boost/preprocessor/seq/for_each.hpp>
 
 #if defined(__CARES_RESOLVE_STR2MODE) || defined(__CARES_RESOLVE_MODE_SEQ) \
@@ -14,13 +16,17 @@
 namespace cares {
 namespace detail {
 
+/* rfc6724: A and AAAA in one AF_UNSPEC query, ordered by c-ares' RFC 6724 sort */
 #define __CARES_RESOLVE_MODE_SEQ \
-    (unspecific)(ipv4_first)(ipv4_only)(ipv6_first)(ipv6_only)(both)
+    (unspecific)(ipv4_first)(ipv4_only)(ipv6_first)(ipv6_only)(both)(rfc6724)
 
 enum resolve_mode {
     BOOST_PP_SEQ_ENUM(__CARES_RESOLVE_MODE_SEQ)
 };
 
+/* the modes are numbered from 0, anything from here on is not one */
+constexpr unsigned resolve_mode_count = BOOST_PP_SEQ_SIZE(__CARES_RESOLVE_MODE_SEQ);
+
 inline bool resolve_mode_from_string(const std::string &str, resolve_mode &mode) {
 #define __CARES_RESOLVE_STR2MODE(unused, data, elem) \
     do { if (data == BOOST_PP_STRINGIZE(elem)) { mode = elem; return true;} } while (false);
@@ -45,6 +51,19 @@ inline bool is_valid_resolve_mode(resolve_mode mode) {
     return false;
 }
 
+/* modes answered by a single ares query, there is nothing to merge */
+constexpr bool is_single_query_mode(resolve_mode mode) {
+    return mode == ipv4_only || mode == ipv6_only || mode == rfc6724;
+}
+
+/* the resolver reads its channel's mode on every lookup, resolve_mode() changes it */
+struct DynamicMode {
+};
+
+/* the mode is decided at compile time and the lookup path specialised for it */
+template<resolve_mode Mode>
+using FixedMode = std::integral_constant<resolve_mode, Mode>;
+
 #undef __CARES_RESOLVE_MODE_IS_VALID
 #undef __CARES_RESOLVE_MODE_ALLMODES
 #undef __CARES_RESOLVE_STR2MODE
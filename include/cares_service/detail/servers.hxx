@@ -0,0 +1,137 @@
+#ifndef __CARES_SERVICES_SERVERS_HXX__
+#define __CARES_SERVICES_SERVERS_HXX__
+
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+#include <ares.h>
+
+namespace cares {
+namespace detail {
+
+struct ServerAddress {
+    boost::asio::ip::address address;
+    uint16_t port; /* 0 means the default dns port */
+
+    bool operator==(const ServerAddress &other) const {
+        return address == other.address && port == other.port;
+    }
+
+    /* the endpoint ares connects to for it */
+    bool IsEndpoint(const boost::asio::ip::address &other, uint16_t other_port) const {
+        return address == other && (port ? port : 53) == other_port;
+    }
+};
+
+using ServerList = std::vector<ServerAddress>;
+
+/* accepts the same forms as ares_set_servers_ports_csv: a.b.c.d[:port], [v6][:port] or bare v6 */
+inline bool ParseServersCsv(const std::string &csv, ServerList &servers) {
+    servers.clear();
+    size_t begin = 0;
+    while (begin <= csv.size()) {
+        auto end = csv.find(',', begin);
+        if (end == std::string::npos) {
+            end = csv.size();
+        }
+        std::string entry = csv.substr(begin, end - begin);
+        begin = end + 1;
+
+        auto first = entry.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            if (end == csv.size()) {
+                break;
+            }
+            return false;
+        }
+        entry = entry.substr(first, entry.find_last_not_of(" \t") - first + 1);
+
+        std::string host = entry;
+        std::string port;
+        if (entry[0] == '[') {
+            auto close = entry.find(']');
+            if (close == std::string::npos) {
+                return false;
+            }
+            host = entry.substr(1, close - 1);
+            if (close + 1 < entry.size()) {
+                if (entry[close + 1] != ':') {
+                    return false;
+                }
+                port = entry.substr(close + 2);
+            }
+        } else if (entry.find(':') == entry.rfind(':') && entry.find(':') != std::string::npos) {
+            host = entry.substr(0, entry.find(':'));
+            port = entry.substr(entry.find(':') + 1);
+        }
+
+        ServerAddress server;
+        boost::system::error_code ec;
+        server.address = boost::asio::ip::make_address(host, ec);
+        if (ec) {
+            return false;
+        }
+        server.port = 0;
+        if (!port.empty()) {
+            if (port.size() > 5 || port.find_first_not_of("0123456789") != std::string::npos) {
+                return false;
+            }
+            auto value = std::stoul(port);
+            if (value > 65535) {
+                return false;
+            }
+            server.port = static_cast<uint16_t>(value);
+        }
+        servers.push_back(std::move(server));
+    }
+    return true;
+}
+
+/* builds the linked list ares_set_servers_ports expects, backed by nodes */
+inline struct ares_addr_port_node *MakeServerNodes(const ServerList &servers, std::vector<struct ares_addr_port_node> &nodes) {
+    nodes.assign(servers.size(), ares_addr_port_node{});
+    for (size_t i = 0; i < servers.size(); ++i) {
+        auto &node = nodes[i];
+        auto &server = servers[i];
+        node.next = (i + 1 < servers.size()) ? &nodes[i + 1] : nullptr;
+        if (server.address.is_v4()) {
+            auto bytes = server.address.to_v4().to_bytes();
+            node.family = AF_INET;
+            memcpy(&node.addr.addr4, bytes.data(), bytes.size());
+        } else {
+            auto bytes = server.address.to_v6().to_bytes();
+            node.family = AF_INET6;
+            memcpy(&node.addr.addr6, bytes.data(), bytes.size());
+        }
+        node.udp_port = server.port;
+        node.tcp_port = server.port;
+    }
+    return nodes.empty() ? nullptr : nodes.data();
+}
+
+/* the other way round, what ares_get_servers_ports hands back */
+inline ServerList ReadServerNodes(const struct ares_addr_port_node *node) {
+    ServerList servers;
+    for (; node; node = node->next) {
+        ServerAddress server;
+        if (node->family == AF_INET) {
+            boost::asio::ip::address_v4::bytes_type bytes;
+            memcpy(bytes.data(), &node->addr.addr4, bytes.size());
+            server.address = boost::asio::ip::address_v4{bytes};
+        } else if (node->family == AF_INET6) {
+            boost::asio::ip::address_v6::bytes_type bytes;
+            memcpy(bytes.data(), &node->addr.addr6, bytes.size());
+            server.address = boost::asio::ip::address_v6{bytes};
+        } else {
+            continue;
+        }
+        server.port = static_cast<uint16_t>(node->udp_port);
+        servers.push_back(std::move(server));
+    }
+    return servers;
+}
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_SERVERS_HXX__
@@ -4,26 +4,78 @@
 #include <memory>
 #include <boost/asio.hpp>
 #include "error.hxx"
+#include "cache.hxx"
+#include "hosts.hxx"
+#include "stats.hxx"
+#include "trace.hxx"
+#include "record.hxx"
 #include "channel.hxx"
+#include "request.hxx"
 #include "resolve_mode.hxx"
 #include "endpoint_sequence.hxx"
 
 namespace cares {
 namespace detail {
 
-template<class Protocol, class ChannelImplementation = Channel>
+template<class Results>
+struct BatchResult {
+    boost::system::error_code error;
+    Results results;
+};
+
+template<class Results>
+struct SrvResult {
+    RecordSet<SrvRecord> records;              /* by priority, weighted random within one, see OrderSrv */
+    std::vector<BatchResult<Results>> targets; /* what records[i] resolved to, on its port */
+};
+
+/* hands a channel's typed answer on to the user's handler */
+template<class Handler>
+struct QueryCompletion {
+    boost::asio::io_context &context;
+    HandlerWork<Handler> work;
+    Handler handler;
+
+    template<class Results>
+    void operator()(boost::system::error_code ec, Results results) {
+        DispatchCompletion(context, std::move(handler), ec, std::move(results));
+        work.reset();
+    }
+};
+
+/*
+ * Trace is the tracing policy, see NoTrace; ChannelImplementation has to
+ * trace with the same one. With enabled false every hook is a constant-false
+ * branch and compiles away. Mode is DynamicMode, or a FixedMode the resolver
+ * is locked to.
+ */
+template<class Protocol, class ChannelImplementation = Channel, class Trace = NoTrace, class Mode = DynamicMode>
 class base_cares_service : public boost::asio::io_context::service {
 public:
     using implementation_type = std::shared_ptr<ChannelImplementation>;
     using results_type = EndpointSequence<Protocol>;
     using resolve_handler = std::function<void(boost::system::error_code, results_type)>;
+    using stream_handler = std::function<void(boost::system::error_code, results_type, bool)>;
+    using batch_results_type = std::vector<BatchResult<results_type>>;
+    using batch_handler = std::function<void(boost::system::error_code, std::shared_ptr<batch_results_type>)>;
+    template<class Record>
+    using records_type = RecordSet<Record>;
+    using srv_results_type = SrvResult<results_type>;
     using native_handle_type = typename ChannelImplementation::native_handle_type;
     using resolve_mode_type = typename ChannelImplementation::resolve_mode;
+    using cache_type = ResolveCache;
+    using hosts_type = HostsTable;
+    using stats_type = StatsSnapshot;
+    using trace_type = Trace;
+    using mode_policy = Mode;
+
+    static_assert(std::is_same<typename ChannelImplementation::trace_type, Trace>::value,
+                  "the channel must trace with the service's policy");
 
     static boost::asio::io_context::id id;
 
     explicit base_cares_service(boost::asio::io_context &context)
-        : boost::asio::io_context::service(context) {
+        : boost::asio::io_context::service(context), next_request_(0) {
         int ret = ::ares_library_init(ARES_LIB_INIT_ALL);
         if (ret != ARES_SUCCESS) {
             boost::system::error_code ec{ret, error::get_category()};
@@ -44,6 +96,9 @@ public:
 
     void construct(implementation_type &impl) {
         impl = std::make_shared<ChannelImplementation>(get_io_context());
+        /* streams, batches and the pool still ask the channel */
+        boost::system::error_code ec;
+        impl->SetResolveMode(mode_of(impl), ec);
     }
 
     void destroy(implementation_type &impl) {
@@ -53,22 +108,225 @@ public:
 
     template<class Handler>
     void async_resolve(implementation_type &impl, const std::string &name, uint16_t port, Handler &&cb) {
+        auto request = trace_resolve(name);
+        resolve(impl, name, port, request, traced(request, std::forward<Handler>(cb), std::integral_constant<bool, Trace::enabled>{}));
+    }
+
+    /*
+     * Same as above, but completes with error::timeout once deadline passes
+     * (zero means none) and can be aborted on its own through handle.
+     */
+    template<class Handler>
+    void async_resolve(implementation_type &impl, const std::string &name, uint16_t port,
+                       std::chrono::steady_clock::duration deadline, RequestHandle *handle, Handler &&cb) {
+        auto request = trace_resolve(name);
+        auto handler = traced(request, std::forward<Handler>(cb), std::integral_constant<bool, Trace::enabled>{});
+        using gate_type = RequestGate<results_type, decltype(handler)>;
+        auto gate = AllocateShared<gate_type>(handler, impl->GetAllocator(), get_io_context(), port, std::move(handler));
+        if (deadline.count() > 0) {
+            gate->Arm(deadline);
+        }
+        if (handle) {
+            handle->Attach(gate);
+        }
+        resolve(impl, name, port, request, GateHandler<gate_type>{gate});
+    }
+
+    /*
+     * Like async_resolve, but each address family is delivered as soon as it
+     * arrives: cb(ec, results, more) is called again while more is true.
+     */
+    template<class Handler>
+    void async_resolve_stream(implementation_type &impl, const std::string &name, uint16_t port, Handler &&cb) {
         auto handler = std::make_shared<Handler>(std::move(cb));
         auto result = std::make_shared<results_type>(port);
 
         boost::system::error_code ec;
         auto address = boost::asio::ip::make_address(name, ec);
-        if (!ec) { /* name is already an ip address, no need to resolve */
+        if (!ec) {
             result->Append(std::move(address));
+            post_stream_result(handler, ec, result);
+            return;
+        }
+
+        auto mode = mode_of(impl);
+        if (lookup_hosts(impl, name, mode, *result)) {
+            post_stream_result(handler, boost::system::error_code{}, result);
+            return;
+        }
+
+        auto cache = impl->GetCache();
+        if (!cache) {
+            impl->AsyncGetHostByNameStream(name, result, handler);
+            return;
+        }
+
+        cache_type::address_list addresses;
+        bool refresh;
+        if (cache->Lookup(name, mode, addresses, ec, refresh)) {
+            for (auto &addr : addresses) {
+                result->Append(std::move(addr));
+            }
+            post_stream_result(handler, ec, result);
+            if (refresh) {
+                refresh_ahead(impl, cache, name, mode);
+            }
+            return;
+        }
+
+        /* the cache gets everything that was streamed, once the last part is in */
+        auto merged = std::make_shared<results_type>(port);
+        auto fill_cache = std::make_shared<stream_handler>(
+            [cache, name, mode, merged, port, handler](boost::system::error_code ec, results_type results, bool more) {
+                merged->Append(results);
+                if (!more && !merged->IsEmpty()) {
+                    cache->Insert(name, mode, *merged, merged->Ttl());
+                } else if (!more && ec) {
+                    cache->InsertError(name, mode, ec);
+                    cache_type::address_list addresses;
+                    if (ResolveCache::IsUpstreamFailure(ec) && cache->LookupStale(name, mode, addresses)) {
+                        results = results_type{port};
+                        for (auto &addr : addresses) {
+                            results.Append(std::move(addr));
+                        }
+                        ec.clear();
+                    }
+                }
+                (*handler)(ec, std::move(results), more);
+            }
+        );
+        impl->AsyncGetHostByNameStream(name, result, fill_cache);
+    }
+
+    /*
+     * Resolves every name of the range with one completion. The table keeps the
+     * order of names, ec is only set when none of them could be resolved.
+     */
+    template<class Names, class Handler>
+    void async_resolve_batch(implementation_type &impl, const Names &names, uint16_t port, Handler &&cb) {
+        using handler_type = typename std::decay<Handler>::type;
+        auto handler = AllocateShared<handler_type>(cb, impl->GetAllocator(), std::forward<Handler>(cb));
+        auto table = std::make_shared<batch_results_type>();
+        auto cache = impl->GetCache();
+        auto mode = mode_of(impl);
+        std::vector<std::pair<size_t, std::string>> pending;
+        boost::system::error_code last_error;
+        bool resolved = false;
+
+        for (auto &name : names) {
+            table->push_back(BatchResult<results_type>{boost::system::error_code{}, results_type{port}});
+            auto &entry = table->back();
+
+            boost::system::error_code ec;
+            auto address = boost::asio::ip::make_address(name, ec);
+            if (!ec) {
+                entry.results.Append(std::move(address));
+                resolved = true;
+                continue;
+            }
+            if (lookup_hosts(impl, name, mode, entry.results)) {
+                resolved = true;
+                continue;
+            }
+            cache_type::address_list addresses;
+            bool refresh;
+            if (cache && cache->Lookup(name, mode, addresses, entry.error, refresh)) {
+                for (auto &addr : addresses) {
+                    entry.results.Append(std::move(addr));
+                }
+                if (refresh) {
+                    refresh_ahead(impl, cache, name, mode);
+                }
+                if (entry.error) {
+                    last_error = entry.error;
+                } else {
+                    resolved = true;
+                }
+                continue;
+            }
+            pending.emplace_back(table->size() - 1, name);
+        }
+
+        if (pending.empty()) {
+            auto ec = resolved ? boost::system::error_code{} : last_error;
             boost::asio::post(
                 get_io_context(),
-                [impl, handler, result]() {
-                    (*handler)(boost::system::error_code{}, *result);
+                [this, impl, handler, ec, table]() {
+                    DispatchCompletion(get_io_context(), std::move(*handler), ec, std::move(*table));
                 }
             );
-        } else {
-            impl->AsyncGetHostByName(name, result, handler);
+            return;
+        }
+
+        std::vector<std::pair<size_t, std::string>> queried;
+        if (cache) {
+            queried = pending;
         }
+        auto finish = std::make_shared<batch_handler>(
+            [this, cache, mode, resolved, queried{std::move(queried)}, handler](boost::system::error_code ec, std::shared_ptr<batch_results_type> results) {
+                bool any = resolved;
+                for (auto &name : queried) {
+                    auto &entry = (*results)[name.first];
+                    if (!entry.error) {
+                        cache->Insert(name.second, mode, entry.results, entry.results.Ttl());
+                        any = true;
+                        continue;
+                    }
+                    cache->InsertError(name.second, mode, entry.error);
+                    cache_type::address_list addresses;
+                    if (ResolveCache::IsUpstreamFailure(entry.error) && cache->LookupStale(name.second, mode, addresses)) {
+                        for (auto &addr : addresses) {
+                            entry.results.Append(std::move(addr));
+                        }
+                        entry.error.clear();
+                        any = true;
+                    }
+                }
+                if (any) {
+                    ec.clear();
+                }
+                DispatchCompletion(get_io_context(), std::move(*handler), ec, std::move(*results));
+            }
+        );
+        impl->AsyncGetHostByNameBatch(std::move(pending), table, finish);
+    }
+
+    /* records of one type for name, completes with void(error_code, records_type<Record>) */
+    template<class Record, class Handler>
+    void async_query(implementation_type &impl, const std::string &name, query_scope scope, Handler &&cb) {
+        using completion_type = QueryCompletion<typename std::decay<Handler>::type>;
+        auto completion = AllocateShared<completion_type>(cb, impl->GetAllocator(), completion_type{get_io_context(), MakeHandlerWork(cb, get_io_context()), std::forward<Handler>(cb)});
+        impl->AsyncQuery(name, Record::kType, scope, std::make_shared<records_type<Record>>(), completion);
+    }
+
+    /* the arpa name is complete, a search suffix could only find someone else's PTR */
+    template<class Handler>
+    void async_reverse(implementation_type &impl, const boost::asio::ip::address &address, Handler &&cb) {
+        async_query<PtrRecord>(impl, ReverseName(address), query_scope::exact, std::forward<Handler>(cb));
+    }
+
+    /*
+     * The SRV records of name in RFC 2782 order, then every target resolved
+     * like async_resolve does, hosts file and cache included. name is looked
+     * up with the search domains like a host name. ec is only set when the
+     * SRV lookup failed or no target could be resolved.
+     */
+    template<class Handler>
+    void async_resolve_srv(implementation_type &impl, const std::string &name, Handler &&cb) {
+        using handler_type = typename std::decay<Handler>::type;
+        auto handler = AllocateShared<handler_type>(cb, impl->GetAllocator(), std::forward<Handler>(cb));
+        auto resolution = std::make_shared<srv_resolution<handler_type>>(get_io_context(), std::move(handler));
+        async_query<SrvRecord>(impl, name, query_scope::search, [this, impl, resolution](boost::system::error_code ec, records_type<SrvRecord> records) mutable {
+            if (ec) {
+                DispatchCompletion(get_io_context(), std::move(*resolution->handler), ec, srv_results_type{});
+                resolution->work.reset();
+                return;
+            }
+            records.Reorder([](typename records_type<SrvRecord>::iterator first, typename records_type<SrvRecord>::iterator last) {
+                OrderSrv(first, last, SrvRandom());
+            });
+            resolve_targets(impl, std::move(records), resolution);
+        });
     }
 
     void cancel(implementation_type &impl) {
@@ -80,10 +338,15 @@ public:
     }
 
     resolve_mode_type resolve_mode(implementation_type &impl) {
-        return impl->GetResolveMode();
+        return mode_of(impl);
     }
 
+    /* a fixed mode resolver only takes its own mode */
     void resolve_mode(implementation_type &impl, resolve_mode_type mode, boost::system::error_code &ec) {
+        if (!std::is_same<Mode, DynamicMode>::value && mode != mode_of(impl)) {
+            ec.assign(error::not_implemented, error::get_category());
+            return;
+        }
         impl->SetResolveMode(mode, ec);
     }
 
@@ -93,17 +356,334 @@ public:
             ec.assign(error::not_implemented, error::get_category());
             return;
         }
-        impl->SetResolveMode(enum_mode, ec);
+        resolve_mode(impl, enum_mode, ec);
+    }
+
+    std::chrono::milliseconds resolution_delay(implementation_type &impl) {
+        return impl->GetResolutionDelay();
+    }
+
+    void resolution_delay(implementation_type &impl, std::chrono::milliseconds delay) {
+        impl->SetResolutionDelay(delay);
+    }
+
+    bool coalesce_readiness(implementation_type &impl) {
+        return impl->GetCoalesceReadiness();
+    }
+
+    void coalesce_readiness(implementation_type &impl, bool enable) {
+        impl->SetCoalesceReadiness(enable);
+    }
+
+    bool batch_datagrams(implementation_type &impl) {
+        return impl->GetBatchDatagrams();
+    }
+
+    void batch_datagrams(implementation_type &impl, bool enable) {
+        impl->SetBatchDatagrams(enable);
+    }
+
+    bool adaptive_servers(implementation_type &impl) {
+        return impl->GetAdaptiveServers();
+    }
+
+    void adaptive_servers(implementation_type &impl, bool enable) {
+        impl->SetAdaptiveServers(enable);
+    }
+
+    bool adaptive_timeout(implementation_type &impl) {
+        return impl->GetAdaptiveTimeout();
+    }
+
+    void adaptive_timeout(implementation_type &impl, bool enable) {
+        impl->SetAdaptiveTimeout(enable);
+    }
+
+    size_t max_in_flight(implementation_type &impl) {
+        return impl->GetMaxInFlight();
+    }
+
+    void max_in_flight(implementation_type &impl, size_t limit) {
+        impl->SetMaxInFlight(limit);
+    }
+
+    size_t max_waiting(implementation_type &impl) {
+        return impl->GetMaxWaiting();
+    }
+
+    void max_waiting(implementation_type &impl, size_t limit) {
+        impl->SetMaxWaiting(limit);
+    }
+
+    void reload_config(implementation_type &impl) {
+        impl->ReloadConfig();
+    }
+
+    std::chrono::milliseconds watch_config(implementation_type &impl) {
+        return impl->GetConfigWatch();
+    }
+
+    void watch_config(implementation_type &impl, std::chrono::milliseconds interval, const std::string &path) {
+        impl->WatchConfig(interval, path);
+    }
+
+    std::shared_ptr<cache_type> cache(implementation_type &impl) {
+        return impl->GetCache();
+    }
+
+    void cache(implementation_type &impl, std::shared_ptr<cache_type> cache) {
+        impl->SetCache(std::move(cache));
+    }
+
+    std::shared_ptr<hosts_type> hosts(implementation_type &impl) {
+        return impl->GetHosts();
+    }
+
+    void hosts(implementation_type &impl, std::shared_ptr<hosts_type> hosts) {
+        impl->SetHosts(std::move(hosts));
+    }
+
+    stats_type stats(implementation_type &impl) {
+        return impl->GetStats();
     }
 
     native_handle_type native_handle(implementation_type &impl) {
         return impl->GetNativeHandle();
     }
 
+    /* only available when ChannelImplementation is a pool */
+    void set_contexts(implementation_type &impl, const std::vector<boost::asio::io_context *> &contexts) {
+        impl->SetContexts(contexts);
+    }
+
+private:
+    template<class Handler>
+    void resolve(implementation_type &impl, const std::string &name, uint16_t port, uint64_t request, Handler &&cb) {
+        using operation_type = ResolveOperation<results_type, typename std::decay<Handler>::type>;
+        auto op = AllocateShared<operation_type>(cb, impl->GetAllocator(), get_io_context(), port, std::forward<Handler>(cb));
+        /* the results live inside the operation */
+        std::shared_ptr<results_type> result{op, &op->GetResults()};
+
+        boost::system::error_code ec;
+        auto address = boost::asio::ip::make_address(name, ec);
+        if (!ec) { /* name is already an ip address, no need to resolve */
+            result->Append(std::move(address));
+            post_result(impl, op, ec, result);
+            return;
+        }
+
+        auto mode = mode_of(impl);
+        if (lookup_hosts(impl, name, mode, *result)) {
+            trace_step(trace_stage::hosts_hit, request, name);
+            post_result(impl, op, boost::system::error_code{}, result);
+            return;
+        }
+
+        auto cache = impl->GetCache();
+        if (!cache) {
+            query(impl, name, result, op);
+            return;
+        }
+
+        cache_type::address_list addresses;
+        bool refresh;
+        if (cache->Lookup(name, mode, addresses, ec, refresh)) {
+            trace_step(trace_stage::cache_hit, request, name);
+            for (auto &addr : addresses) {
+                result->Append(std::move(addr));
+            }
+            post_result(impl, op, ec, result);
+            if (refresh) {
+                refresh_ahead(impl, cache, name, mode);
+            }
+            return;
+        }
+        trace_step(trace_stage::cache_miss, request, name);
+
+        /* with stale data at hand, don't keep the caller waiting on a slow upstream */
+        auto stale_timeout = cache->GetOptions().stale_answer_timeout;
+        bool has_stale = stale_timeout.count() > 0 && cache->LookupStale(name, mode, addresses);
+        op->SetCache(std::move(cache), name, mode);
+        if (has_stale) {
+            op->ArmStale(stale_timeout);
+        }
+        query(impl, name, result, op);
+    }
+
+    static resolve_mode_type mode_of(implementation_type &impl) {
+        return mode_of(impl, Mode{});
+    }
+
+    static resolve_mode_type mode_of(implementation_type &impl, DynamicMode) {
+        return impl->GetResolveMode();
+    }
+
+    template<resolve_mode_type Fixed>
+    static resolve_mode_type mode_of(implementation_type &, FixedMode<Fixed>) {
+        return Fixed;
+    }
+
+    /* a dynamic mode is read by the channel, a fixed one travels along as a tag */
+    template<class Handler>
+    static void query(implementation_type &impl, const std::string &name, std::shared_ptr<results_type> result, std::shared_ptr<Handler> op) {
+        query(impl, name, result, op, Mode{});
+    }
+
+    template<class Handler>
+    static void query(implementation_type &impl, const std::string &name, std::shared_ptr<results_type> result, std::shared_ptr<Handler> op, DynamicMode) {
+        impl->AsyncGetHostByName(name, result, op);
+    }
+
+    template<class Handler, resolve_mode_type Fixed>
+    static void query(implementation_type &impl, const std::string &name, std::shared_ptr<results_type> result, std::shared_ptr<Handler> op, FixedMode<Fixed> mode) {
+        impl->AsyncGetHostByName(name, result, op, mode);
+    }
+
+    /* from the SRV query until the last target is in */
+    template<class Handler>
+    struct srv_resolution {
+        srv_resolution(boost::asio::io_context &ios, std::shared_ptr<Handler> handler)
+            : work(MakeHandlerWork(*handler, ios)), handler(std::move(handler)), remain(0) {
+        }
+
+        srv_results_type results;
+        HandlerWork<Handler> work;
+        std::shared_ptr<Handler> handler;
+        std::atomic<size_t> remain;
+    };
+
+    template<class Handler>
+    void finish_targets(const std::shared_ptr<srv_resolution<Handler>> &resolution) {
+        boost::system::error_code ec;
+        for (auto &target : resolution->results.targets) {
+            if (!target.error) {
+                ec.clear();
+                break;
+            }
+            ec = target.error;
+        }
+        DispatchCompletion(get_io_context(), std::move(*resolution->handler), ec, std::move(resolution->results));
+        resolution->work.reset();
+    }
+
+    /* "." as target says there is no such service there, it is not looked up */
+    template<class Handler>
+    void resolve_targets(implementation_type &impl, records_type<SrvRecord> records, std::shared_ptr<srv_resolution<Handler>> resolution) {
+        resolution->remain = 1;
+        auto &targets = resolution->results.targets;
+        for (auto &record : records) {
+            targets.push_back(BatchResult<results_type>{boost::system::error_code{}, results_type{record.port}});
+            if (record.target.empty()) {
+                targets.back().error.assign(ARES_ENODATA, error::get_category());
+            } else {
+                ++resolution->remain;
+            }
+        }
+        resolution->results.records = std::move(records);
+
+        auto &resolved = resolution->results.records;
+        for (size_t i = 0; i < resolved.size(); ++i) {
+            if (resolved[i].target.empty()) {
+                continue;
+            }
+            auto target = resolved[i].target.to_string();
+            auto request = trace_resolve(target);
+            auto done = [this, resolution, i](boost::system::error_code ec, results_type results) {
+                resolution->results.targets[i] = BatchResult<results_type>{ec, std::move(results)};
+                if (resolution->remain.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    finish_targets(resolution);
+                }
+            };
+            resolve(impl, target, resolved[i].port, request, traced(request, std::move(done), std::integral_constant<bool, Trace::enabled>{}));
+        }
+        if (resolution->remain.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            finish_targets(resolution);
+        }
+    }
+
+    /* request id for the trace, 0 when tracing is off */
+    uint64_t trace_resolve(const std::string &name) {
+        if (!Trace::enabled) {
+            return 0;
+        }
+        auto request = ++next_request_;
+        trace_step(trace_stage::resolve, request, name);
+        return request;
+    }
+
+    void trace_step(trace_stage stage, uint64_t request, const std::string &name) {
+        if (Trace::enabled) {
+            trace_(TraceEvent{stage, std::chrono::steady_clock::now(), request, name.c_str(), AF_UNSPEC, ARES_SOCKET_BAD, boost::system::error_code{}});
+        }
+    }
+
+    template<class Handler>
+    typename std::decay<Handler>::type traced(uint64_t, Handler &&cb, std::false_type) {
+        return std::forward<Handler>(cb);
+    }
+
+    template<class Handler>
+    TracedHandler<Trace, typename std::decay<Handler>::type> traced(uint64_t request, Handler &&cb, std::true_type) {
+        return {trace_, request, std::forward<Handler>(cb)};
+    }
+
+    /* hosts file entries win over the cache and the servers, they go straight into results */
+    template<class Results>
+    bool lookup_hosts(implementation_type &impl, const std::string &name, resolve_mode_type mode, Results &results) {
+        auto hosts = impl->GetHosts();
+        return hosts && hosts->Lookup(name, mode, results);
+    }
+
+    /* stores what the background query brought, or lets the next hit try again */
+    struct cache_refresh {
+        std::shared_ptr<cache_type> cache;
+        std::string name;
+        resolve_mode_type mode;
+
+        void operator()(boost::system::error_code ec, results_type results) {
+            if (!ec) {
+                cache->Insert(name, mode, results, results.Ttl());
+            } else {
+                cache->AbortRefresh(name, mode);
+            }
+        }
+    };
+
+    /* the entry is hot and about to expire: fetch it again while it is still served */
+    void refresh_ahead(implementation_type &impl, const std::shared_ptr<cache_type> &cache, const std::string &name, resolve_mode_type mode) {
+        using operation_type = ResolveOperation<results_type, cache_refresh>;
+        cache_refresh refresh{cache, name, mode};
+        auto op = AllocateShared<operation_type>(refresh, impl->GetAllocator(), get_io_context(), 0, std::move(refresh));
+        std::shared_ptr<results_type> result{op, &op->GetResults()};
+        query(impl, name, result, op);
+    }
+
+    template<class Handler>
+    void post_stream_result(std::shared_ptr<Handler> handler, boost::system::error_code ec, std::shared_ptr<results_type> result) {
+        boost::asio::post(
+            get_io_context(),
+            [handler, ec, result]() {
+                (*handler)(ec, std::move(*result), false);
+            }
+        );
+    }
+
+    template<class Handler>
+    void post_result(implementation_type &impl, std::shared_ptr<Handler> handler, boost::system::error_code ec, std::shared_ptr<results_type> result) {
+        boost::asio::post(
+            get_io_context(),
+            [impl, handler, ec, result]() {
+                (*handler)(ec, std::move(*result));
+            }
+        );
+    }
+
+    Trace trace_;
+    std::atomic<uint64_t> next_request_;
 };
 
-template<class Protocol, class ChannelImplementation>
-boost::asio::io_context::id base_cares_service<Protocol, ChannelImplementation>::id;
+template<class Protocol, class ChannelImplementation, class Trace, class Mode>
+boost::asio::io_context::id base_cares_service<Protocol, ChannelImplementation, Trace, Mode>::id;
 
 } // namespace detail
 } // namespace cares
@@ -0,0 +1,310 @@
+#ifndef __CARES_SERVICES_STATS_HXX__
+#define __CARES_SERVICES_STATS_HXX__
+
+#include <map>
+#include <array>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <boost/asio.hpp>
+
+#include "resolve_mode.hxx"
+
+namespace cares {
+namespace detail {
+
+/*
+ * Log-linear buckets over microseconds: exact below 16us, then 8 buckets per
+ * power of two, so any value is off by at most 12.5%. Covers up to ~35
+ * minutes, anything longer lands in the last bucket.
+ */
+struct HistogramLayout {
+    static constexpr unsigned kSubBits = 3;
+    static constexpr uint64_t kSub = uint64_t{1} << kSubBits;
+    static constexpr unsigned kMaxBit = 30;
+    static constexpr size_t kBuckets = (kMaxBit - kSubBits + 2) * kSub;
+
+    static size_t BucketOf(uint64_t micros) {
+        if (micros < 2 * kSub) {
+            return static_cast<size_t>(micros);
+        }
+        unsigned msb = 63 - Clz(micros);
+        if (msb > kMaxBit) {
+            return kBuckets - 1;
+        }
+        auto shift = msb - kSubBits;
+        return (msb - kSubBits + 1) * kSub + ((micros >> shift) - kSub);
+    }
+
+    /* smallest value of the bucket */
+    static uint64_t LowerBound(size_t bucket) {
+        if (bucket < 2 * kSub) {
+            return bucket;
+        }
+        auto group = bucket / kSub;
+        return (kSub + bucket % kSub) << (group - 1);
+    }
+
+    static unsigned Clz(uint64_t value) {
+#if defined(__GNUC__)
+        return static_cast<unsigned>(__builtin_clzll(value));
+#else
+        unsigned count = 0;
+        for (uint64_t bit = uint64_t{1} << 63; bit && !(value & bit); bit >>= 1) {
+            ++count;
+        }
+        return count;
+#endif
+    }
+};
+
+/* a copy of a histogram, safe to keep and merge */
+class HistogramSnapshot {
+public:
+    using duration = std::chrono::microseconds;
+
+    HistogramSnapshot() {
+        counts_.fill(0);
+    }
+
+    uint64_t Count() const {
+        return count_;
+    }
+
+    duration Max() const {
+        return duration{static_cast<duration::rep>(max_)};
+    }
+
+    duration Mean() const {
+        return duration{static_cast<duration::rep>(count_ ? sum_ / count_ : 0)};
+    }
+
+    /* upper edge of the bucket holding the p-th percentile, p in [0, 100] */
+    duration Percentile(double p) const {
+        if (count_ == 0) {
+            return duration::zero();
+        }
+        auto rank = static_cast<uint64_t>(std::max(1.0, p / 100.0 * static_cast<double>(count_) + 0.5));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                auto upper = (i + 1 < counts_.size()) ? HistogramLayout::LowerBound(i + 1) - 1 : max_;
+                return duration{static_cast<duration::rep>(std::min(upper, max_))};
+            }
+        }
+        return Max();
+    }
+
+    void Merge(const HistogramSnapshot &other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        count_ += other.count_;
+        sum_ += other.sum_;
+        max_ = std::max(max_, other.max_);
+    }
+
+private:
+    friend class LatencyHistogram;
+
+    std::array<uint64_t, HistogramLayout::kBuckets> counts_;
+    uint64_t count_ = 0;
+    uint64_t sum_ = 0;
+    uint64_t max_ = 0;
+};
+
+/* recording is a few relaxed atomic adds, readers take a Snapshot() */
+class LatencyHistogram {
+public:
+    LatencyHistogram() {
+        for (auto &count : counts_) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    template<class Rep, class Period>
+    void Record(std::chrono::duration<Rep, Period> elapsed) {
+        auto micros = static_cast<uint64_t>(std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()));
+        counts_[HistogramLayout::BucketOf(micros)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(micros, std::memory_order_relaxed);
+        auto max = max_.load(std::memory_order_relaxed);
+        while (micros > max && !max_.compare_exchange_weak(max, micros, std::memory_order_relaxed)) {
+        }
+    }
+
+    HistogramSnapshot Snapshot() const {
+        HistogramSnapshot snapshot;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            snapshot.counts_[i] = counts_[i].load(std::memory_order_relaxed);
+        }
+        snapshot.count_ = count_.load(std::memory_order_relaxed);
+        snapshot.sum_ = sum_.load(std::memory_order_relaxed);
+        snapshot.max_ = max_.load(std::memory_order_relaxed);
+        return snapshot;
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, HistogramLayout::kBuckets> counts_;
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+/* udp round trips to one server, paired send to answer in order */
+struct ServerStats {
+    boost::asio::ip::address address;
+    uint16_t port;
+    uint64_t sent;
+    uint64_t received;
+    HistogramSnapshot rtt;
+};
+
+/* what basic_cares_resolver::stats() hands out, summed over a pool */
+struct StatsSnapshot {
+    static constexpr size_t kModes = resolve_mode_count;
+
+    uint64_t queries = 0;        /* ares queries issued, one per family */
+    uint64_t coalesced = 0;      /* lookups that joined a query already on the wire */
+    uint64_t answers = 0;        /* including name errors */
+    uint64_t failures = 0;
+    uint64_t timeouts = 0;       /* also counted in failures */
+    uint64_t tcp_connections = 0; /* truncated answers retried over tcp, and tcp forced by the config */
+    uint64_t sockets_opened = 0;
+    uint64_t queued = 0;         /* lookups that waited for an in-flight slot */
+    uint64_t rejected = 0;       /* turned away with error::overloaded */
+    uint64_t reloads = 0;        /* the system config read again into a fresh ares channel */
+    int64_t in_flight = 0;
+    int64_t waiting = 0;         /* queued right now */
+    int64_t open_sockets = 0;
+    HistogramSnapshot ipv4_latency; /* per ares query */
+    HistogramSnapshot ipv6_latency;
+    HistogramSnapshot dual_latency; /* AF_UNSPEC queries of rfc6724 */
+    std::array<HistogramSnapshot, kModes> resolve_latency; /* per async_resolve, by resolve mode */
+    std::vector<ServerStats> servers;
+
+    void Merge(const StatsSnapshot &other) {
+        queries += other.queries;
+        coalesced += other.coalesced;
+        answers += other.answers;
+        failures += other.failures;
+        timeouts += other.timeouts;
+        tcp_connections += other.tcp_connections;
+        sockets_opened += other.sockets_opened;
+        queued += other.queued;
+        rejected += other.rejected;
+        reloads += other.reloads;
+        in_flight += other.in_flight;
+        waiting += other.waiting;
+        open_sockets += other.open_sockets;
+        ipv4_latency.Merge(other.ipv4_latency);
+        ipv6_latency.Merge(other.ipv6_latency);
+        dual_latency.Merge(other.dual_latency);
+        for (size_t i = 0; i < kModes; ++i) {
+            resolve_latency[i].Merge(other.resolve_latency[i]);
+        }
+        for (auto &server : other.servers) {
+            auto itr = std::find_if(servers.begin(), servers.end(), [&](const ServerStats &mine) {
+                return mine.address == server.address && mine.port == server.port;
+            });
+            if (itr == servers.end()) {
+                servers.push_back(server);
+                continue;
+            }
+            itr->sent += server.sent;
+            itr->received += server.received;
+            itr->rtt.Merge(server.rtt);
+        }
+    }
+};
+
+/*
+ * Live counters of one Channel. Everything is a relaxed atomic, the only
+ * lock guards the server table and is taken when a socket connects.
+ */
+class ChannelStats {
+public:
+    struct Server {
+        std::atomic<uint64_t> sent{0};
+        std::atomic<uint64_t> received{0};
+        LatencyHistogram rtt;
+    };
+
+    std::atomic<uint64_t> queries{0};
+    std::atomic<uint64_t> coalesced{0};
+    std::atomic<uint64_t> answers{0};
+    std::atomic<uint64_t> failures{0};
+    std::atomic<uint64_t> timeouts{0};
+    std::atomic<uint64_t> tcp_connections{0};
+    std::atomic<uint64_t> sockets_opened{0};
+    std::atomic<uint64_t> queued{0};
+    std::atomic<uint64_t> rejected{0};
+    std::atomic<uint64_t> reloads{0};
+    std::atomic<int64_t> in_flight{0};
+    std::atomic<int64_t> waiting{0};
+    std::atomic<int64_t> open_sockets{0};
+    LatencyHistogram ipv4_latency;
+    LatencyHistogram ipv6_latency;
+    LatencyHistogram dual_latency;
+    std::array<LatencyHistogram, StatsSnapshot::kModes> resolve_latency;
+
+    /* stable for the life of the channel, sockets keep the pointer */
+    Server *GetServer(const boost::asio::ip::address &address, uint16_t port) {
+        std::lock_guard<std::mutex> lock{mutex_};
+        auto &server = servers_[std::make_pair(address, port)];
+        if (!server) {
+            server.reset(new Server{});
+        }
+        return server.get();
+    }
+
+    StatsSnapshot Snapshot() const {
+        StatsSnapshot snapshot;
+        snapshot.queries = queries.load(std::memory_order_relaxed);
+        snapshot.coalesced = coalesced.load(std::memory_order_relaxed);
+        snapshot.answers = answers.load(std::memory_order_relaxed);
+        snapshot.failures = failures.load(std::memory_order_relaxed);
+        snapshot.timeouts = timeouts.load(std::memory_order_relaxed);
+        snapshot.tcp_connections = tcp_connections.load(std::memory_order_relaxed);
+        snapshot.sockets_opened = sockets_opened.load(std::memory_order_relaxed);
+        snapshot.queued = queued.load(std::memory_order_relaxed);
+        snapshot.rejected = rejected.load(std::memory_order_relaxed);
+        snapshot.reloads = reloads.load(std::memory_order_relaxed);
+        snapshot.in_flight = in_flight.load(std::memory_order_relaxed);
+        snapshot.waiting = waiting.load(std::memory_order_relaxed);
+        snapshot.open_sockets = open_sockets.load(std::memory_order_relaxed);
+        snapshot.ipv4_latency = ipv4_latency.Snapshot();
+        snapshot.ipv6_latency = ipv6_latency.Snapshot();
+        snapshot.dual_latency = dual_latency.Snapshot();
+        for (size_t i = 0; i < StatsSnapshot::kModes; ++i) {
+            snapshot.resolve_latency[i] = resolve_latency[i].Snapshot();
+        }
+        std::lock_guard<std::mutex> lock{mutex_};
+        for (auto &server : servers_) {
+            snapshot.servers.push_back(ServerStats{
+                server.first.first, server.first.second,
+                server.second->sent.load(std::memory_order_relaxed),
+                server.second->received.load(std::memory_order_relaxed),
+                server.second->rtt.Snapshot()
+            });
+        }
+        return snapshot;
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::map<std::pair<boost::asio::ip::address, uint16_t>, std::unique_ptr<Server>> servers_;
+};
+
+} // namespace detail
+} // namespace cares
+
+#endif // __CARES_SERVICES_STATS_HXX__
@@ -0,0 +1,94 @@
+#ifndef __CARES_SERVICES_TRACE_HXX__
+#define __CARES_SERVICES_TRACE_HXX__
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <boost/asio.hpp>
+#include <ares.h>
+
+namespace cares {
+namespace detail {
+
+enum class trace_stage {
+    resolve,    /* async_resolve entered */
+    hosts_hit,  /* answered from the hosts table */
+    cache_hit,
+    cache_miss,
+    submit,     /* ares_getaddrinfo for one family */
+    join,       /* same name and family already on the wire, waits for that answer */
+    queue,      /* no in-flight slot free, waits for one */
+    reject,     /* no slot and no room to wait, fails with error::overloaded */
+    wake,       /* a socket turned ready, ares is about to process it */
+    answer,     /* ares completed one family */
+    complete,   /* the user's handler is about to run */
+};
+
+/*
+ * One lifecycle step. Service side events carry the request id handed out
+ * at resolve, channel side events (submit to answer) only the name and
+ * family, since one query may serve several requests. name is only valid
+ * for the duration of the call.
+ */
+struct TraceEvent {
+    trace_stage stage;
+    std::chrono::steady_clock::time_point at;
+    uint64_t request;
+    const char *name;
+    int family;
+    ares_socket_t fd;
+    boost::system::error_code error;
+};
+
+/*
+ * Tracing policy of base_cares_service and its channels: enabled and
+ * operator()(event). The service and every channel default construct
+ * their own, keep shared state behind a pointer or in statics.
+ */
+struct NoTrace {
+    static constexpr bool enabled = false;
+
+    void operator()(const TraceEvent &) const {
+    }
+};
+
+/* completes through the real handler, tracing the moment it runs */
+template<class Trace, class Handler>
+struct TracedHandler {
+    using allocator_type = boost::asio::associated_allocator_t<Handler>;
+
+    allocator_type get_allocator() const noexcept {
+        return boost::asio::get_associated_allocator(handler);
+    }
+
+    template<class Results>
+    void operator()(boost::system::error_code ec, Results results) {
+        trace(TraceEvent{trace_stage::complete, std::chrono::steady_clock::now(), request, nullptr, AF_UNSPEC, ARES_SOCKET_BAD, ec});
+        handler(ec, std::move(results));
+    }
+
+    Trace trace;
+    uint64_t request;
+    Handler handler;
+};
+
+} // namespace detail
+} // namespace cares
+
+namespace boost {
+namespace asio {
+
+/* the handler's own executor, or whatever fallback the caller passes */
+template<class Trace, class Handler, class Executor>
+struct associated_executor<cares::detail::TracedHandler<Trace, Handler>, Executor> {
+    using type = associated_executor_t<Handler, Executor>;
+
+    static type get(const cares::detail::TracedHandler<Trace, Handler> &traced, const Executor &executor = Executor()) noexcept {
+        return associated_executor<Handler, Executor>::get(traced.handler, executor);
+    }
+};
+
+} // namespace asio
+} // namespace boost
+
+#endif // __CARES_SERVICES_TRACE_HXX__